@@ -0,0 +1,201 @@
+#pragma once
+
+#include <eosio/chain/abi_serializer.hpp>
+#include <eosio/chain/contract_table_objects.hpp>
+#include <eosio/chain/resource_limits.hpp>
+#include <eosio/testing/tester.hpp>
+
+#include <fc/io/json.hpp>
+#include <fc/variant_object.hpp>
+
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "contracts.hpp"
+
+using namespace eosio::chain;
+using namespace eosio::testing;
+using mvo = fc::mutable_variant_object;
+
+namespace dmc_bench {
+
+// the cost of one pushed transaction as the chain billed it
+struct bench_result {
+    std::string scenario;
+    std::string action;
+    uint64_t cpu_us = 0;
+    uint64_t net_bytes = 0;
+    int64_t ram_delta = 0;
+    uint64_t inline_actions = 0;
+    uint64_t notifications = 0;
+    uint64_t elapsed_us = 0;
+};
+
+/**
+ * one json object per line, the keys never change so the output of two commits can be joined on scenario + action
+ */
+inline void report(const bench_result& r) {
+    fc::variant v = mvo()
+        ("scenario", r.scenario)
+        ("action", r.action)
+        ("cpu_us", r.cpu_us)
+        ("net_bytes", r.net_bytes)
+        ("ram_delta", r.ram_delta)
+        ("inline_actions", r.inline_actions)
+        ("notifications", r.notifications)
+        ("elapsed_us", r.elapsed_us);
+    std::cout << fc::json::to_string(v) << std::endl;
+}
+
+class bench_tester : public tester {
+public:
+    static constexpr uint32_t txs_per_block = 50;
+
+    bench_tester() {
+        produce_blocks(2);
+    }
+
+    // name from an index with only the characters of a valid account name
+    static account_name indexed_name(const std::string& prefix, uint64_t index) {
+        static const char charmap[] = "abcdefghijklmnopqrstuvwxyz12345";
+        std::string suffix;
+        for (int i = 0; i < 12 - (int)prefix.size(); i++) {
+            suffix.insert(suffix.begin(), charmap[index % 31]);
+            index /= 31;
+        }
+        return account_name(prefix + suffix);
+    }
+
+    void create_tracked_accounts(const std::vector<account_name>& names) {
+        for (const auto& n : names) {
+            create_account(n);
+            tracked.insert(n);
+            seeded();
+        }
+    }
+
+    void deploy(account_name account, const std::vector<uint8_t>& wasm, const std::vector<char>& abi) {
+        set_code(account, wasm);
+        set_abi(account, abi.data());
+        produce_block();
+
+        const auto& accnt = control->db().get<account_object, by_name>(account);
+        abi_def abi_definition;
+        BOOST_REQUIRE_EQUAL(abi_serializer::to_abi(accnt.abi, abi_definition), true);
+        abi_ser.set_abi(abi_definition, abi_serializer_max_time);
+    }
+
+    // actions sent by `code` to itself with `code`@eosio.code may spend `account`@active
+    void grant_code(account_name account, account_name code) {
+        auto auth = authority(get_public_key(account, "active"));
+        auth.accounts.push_back(permission_level_weight{ { code, config::eosio_code_name }, 1 });
+        set_authority(account, config::active_name, auth, config::owner_name);
+        seeded();
+    }
+
+    // a seeding action, its cost is not reported
+    transaction_trace_ptr seed(account_name code, const action_name& name, account_name actor, const fc::variant_object& data) {
+        auto trace = push_action(code, name, actor, data);
+        seeded();
+        return trace;
+    }
+
+    bench_result measure(const std::string& scenario, account_name code, const action_name& name, account_name actor, const fc::variant_object& data) {
+        produce_block();
+        int64_t ram_before = tracked_ram();
+        auto trace = push_action(code, name, actor, data);
+        int64_t ram_after = tracked_ram();
+        produce_block();
+
+        bench_result r = result_of(scenario, name.to_string(), trace);
+        r.ram_delta = ram_after - ram_before;
+        return r;
+    }
+
+    static bench_result result_of(const std::string& scenario, const std::string& action, const transaction_trace_ptr& trace) {
+        bench_result r;
+        r.scenario = scenario;
+        r.action = action;
+        r.cpu_us = trace->receipt ? trace->receipt->cpu_usage_us : 0;
+        r.net_bytes = trace->net_usage;
+        r.elapsed_us = trace->elapsed.count();
+        for (const auto& at : trace->action_traces) {
+            if (at.creator_action_ordinal.value == 0)
+                continue;
+            // a notification runs the same action under another receiver
+            if (at.receiver == at.act.account)
+                r.inline_actions++;
+            else
+                r.notifications++;
+        }
+        return r;
+    }
+
+    int64_t tracked_ram() {
+        const auto& rlm = control->get_resource_limits_manager();
+        int64_t total = 0;
+        for (const auto& n : tracked) {
+            total += rlm.get_account_ram_usage(n);
+        }
+        return total;
+    }
+
+    fc::variant get_row(account_name code, uint64_t scope, const name& table, uint64_t key, const std::string& type) {
+        vector<char> data = get_row_by_account(code, name(scope), table, name(key));
+        return data.empty() ? fc::variant() : abi_ser.binary_to_variant(type, data, abi_serializer_max_time);
+    }
+
+    /**
+     * writes a row straight into the state of the pending block, for the state no action can reach in a bench chain,
+     * the ram of the row is not billed to anyone
+     */
+    void set_row(account_name code, uint64_t scope, const name& table, uint64_t key, const std::vector<char>& data) {
+        auto& db = control->mutable_db();
+        const auto* t_id = db.find<table_id_object, by_code_scope_table>(boost::make_tuple(code, name(scope), table));
+        if (!t_id) {
+            t_id = &db.create<table_id_object>([&](auto& t) {
+                t.code = code;
+                t.scope = name(scope);
+                t.table = table;
+                t.payer = code;
+            });
+        }
+        const auto* kv = db.find<key_value_object, by_scope_primary>(boost::make_tuple(t_id->id, key));
+        if (kv) {
+            db.modify(*kv, [&](auto& o) {
+                o.value.assign(data.data(), data.size());
+            });
+        } else {
+            db.create<key_value_object>([&](auto& o) {
+                o.t_id = t_id->id;
+                o.primary_key = key;
+                o.payer = code;
+                o.value.assign(data.data(), data.size());
+            });
+            db.modify(*t_id, [](auto& t) {
+                ++t.count;
+            });
+        }
+    }
+
+    void set_row(account_name code, uint64_t scope, const name& table, uint64_t key, const std::string& type, const fc::variant& row) {
+        set_row(code, scope, table, key, abi_ser.variant_to_binary(type, row, abi_serializer_max_time));
+    }
+
+    abi_serializer abi_ser;
+    std::set<account_name> tracked;
+
+private:
+    void seeded() {
+        if (++pending_txs >= txs_per_block) {
+            produce_block();
+            pending_txs = 0;
+        }
+    }
+
+    uint32_t pending_txs = 0;
+};
+
+} // namespace dmc_bench
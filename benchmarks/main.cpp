@@ -0,0 +1,410 @@
+#include "bench_tester.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace dmc_bench;
+
+namespace {
+
+const account_name token_account = N(dmc.token);
+const account_name system_account = N(datamall);
+const account_name config_account = N(dmcconfigura);
+const account_name abo_account = N(dmfoundation);
+const account_name dmc_account = N(dmc);
+
+const symbol dmc_symbol = symbol(4, "DMC");
+const symbol rsi_symbol = symbol(4, "RSI");
+const symbol pst_symbol = symbol(0, "PST");
+
+constexpr uint64_t week_sec = 7 * 24 * 3600;
+// the minimum service of an order with the default claim interval
+constexpr uint64_t order_epoch = 24;
+
+/**
+ * table sizes of the seeded chain, every count is divided by --scale so a smaller run keeps the same shape
+ */
+struct bench_config {
+    uint64_t miners = 100;
+    uint64_t resting_bills = 10000;
+    uint64_t users = 1000;
+    uint64_t orders = 100000;
+    uint64_t orders_per_bill = 100;
+    uint64_t lps = 500;
+    uint64_t price_levels = 1000;
+    // more than the 21 elected ones, so the set has a threshold
+    uint64_t producers = 30;
+
+    void scale(uint64_t divisor) {
+        for (auto* count : { &miners, &resting_bills, &users, &orders, &lps, &price_levels, &producers }) {
+            *count = std::max<uint64_t>(*count / divisor, 2);
+        }
+    }
+};
+
+fc::variant ext(int64_t amount, const symbol& sym) {
+    return mvo()("quantity", asset(amount, sym))("contract", system_account);
+}
+
+int64_t units(double value, const symbol& sym) {
+    return std::llround(value * sym.precision());
+}
+
+class token_bench : public bench_tester {
+public:
+    explicit token_bench(const bench_config& c) : cfg(c) {
+        create_tracked_accounts({ token_account, system_account, config_account, abo_account, dmc_account });
+        deploy(token_account, contracts::token_wasm(), contracts::token_abi());
+        grant_code(system_account, token_account);
+
+        for (const auto& sym : { dmc_symbol, rsi_symbol }) {
+            seed(token_account, N(excreate), system_account, mvo()
+                ("issuer", system_account)
+                ("maximum_supply", asset(units(1e14, sym), sym))
+                ("reserve_supply", asset(0, sym))
+                ("expiration", "1970-01-01T00:00:00"));
+        }
+        seed(token_account, N(excreate), system_account, mvo()
+            ("issuer", system_account)
+            ("maximum_supply", asset(1000000000000ll, pst_symbol))
+            ("reserve_supply", asset(0, pst_symbol))
+            ("expiration", "1970-01-01T00:00:00"));
+
+        // a new deployment has nothing to migrate, one call marks each table ready
+        for (auto act : { N(bookmigrate), N(billmigrate), N(phishmigrate) }) {
+            seed(token_account, act, config_account, mvo()("limit", 1));
+        }
+    }
+
+    void issue(account_name to, int64_t amount, const symbol& sym) {
+        seed(token_account, N(exissue), system_account, mvo()
+            ("to", to)
+            ("quantity", ext(amount, sym))
+            ("memo", "seed " + std::to_string(++issued)));
+    }
+
+    void seed_makers() {
+        for (uint64_t i = 0; i < cfg.miners; i++) {
+            miners.push_back(indexed_name("miner", i));
+        }
+        create_tracked_accounts(miners);
+
+        uint64_t filler_bills = (cfg.orders + cfg.orders_per_bill - 1) / cfg.orders_per_bill;
+        uint64_t pst_per_miner = (filler_bills / cfg.miners + 1) * cfg.orders_per_bill + (cfg.resting_bills / cfg.miners + 1) * 10;
+        for (const auto& miner : miners) {
+            issue(miner, units(2000000, dmc_symbol), dmc_symbol);
+            seed(token_account, N(increase), miner, mvo()
+                ("owner", miner)
+                ("asset", ext(units(1000000, dmc_symbol), dmc_symbol))
+                ("miner", miner));
+            seed(token_account, N(mint), miner, mvo()
+                ("owner", miner)
+                ("asset", ext(pst_per_miner, pst_symbol)));
+        }
+    }
+
+    void place_bill(account_name miner, int64_t pst, uint64_t level) {
+        // 0.1 DMC and one more 0.0001 per level, every level is a distinct book and price history entry
+        double price = (1000 + level % cfg.price_levels) / 10000.0;
+        seed(token_account, N(bill), miner, mvo()
+            ("owner", miner)
+            ("asset", ext(pst, pst_symbol))
+            ("price", price)
+            ("expire_on", control->head_block_time() + fc::seconds(25 * week_sec))
+            ("deposit_ratio", 1)
+            ("memo", "bench"));
+        bill_owners.push_back(miner);
+    }
+
+    uint64_t benchmark_price() {
+        auto row = get_row(token_account, token_account.to_uint64_t(), N(benchprice), 0, "bench_price");
+        double price = row.is_null() ? 0.1 : row["benchmark_price"].as_double();
+        return std::llround(price * 10000);
+    }
+
+    fc::variant_object order_args(account_name user, uint64_t bill_id) {
+        return mvo()
+            ("owner", user)
+            ("bill_id", bill_id)
+            ("benchmark_price", benchmark_price())
+            ("price_range", 3)
+            ("epoch", order_epoch)
+            ("asset", ext(1, pst_symbol))
+            ("reserve", ext(units(10, dmc_symbol), dmc_symbol))
+            ("memo", "bench " + std::to_string(order_owners.size()));
+    }
+
+    /**
+     * orders fill one bill at a time so that bill is always the cheapest level and the level limit never rejects it,
+     * each filled bill is erased and leaves its price in the history
+     */
+    void seed_orders() {
+        for (uint64_t i = 0; i < cfg.users; i++) {
+            users.push_back(indexed_name("user", i));
+        }
+        create_tracked_accounts(users);
+        for (const auto& user : users) {
+            issue(user, units(20 * (cfg.orders / cfg.users + 1) + 10000, dmc_symbol), dmc_symbol);
+        }
+
+        for (uint64_t k = 0; k < cfg.orders; k++) {
+            if (k % cfg.orders_per_bill == 0) {
+                place_bill(miners[k / cfg.orders_per_bill % miners.size()], cfg.orders_per_bill, k / cfg.orders_per_bill);
+            }
+            account_name user = users[k % users.size()];
+            seed(token_account, N(order), user, order_args(user, bill_owners.size()));
+            order_owners.push_back(user);
+            order_miners.push_back(bill_owners.back());
+        }
+    }
+
+    // the bills left in the book, above every price the orders paid
+    void seed_resting_bills() {
+        for (uint64_t i = 0; i < cfg.resting_bills; i++) {
+            place_bill(miners[i % miners.size()], 10, cfg.price_levels - 1);
+        }
+    }
+
+    /**
+     * a single maker with `lps` partners, every partner adds 1% of the total stake, above the share a partner needs,
+     * and the miner tops up to stay above the lowest miner rate
+     */
+    void seed_partnership() {
+        lp_miner = N(lpminer);
+        create_tracked_accounts({ lp_miner });
+        for (uint64_t i = 0; i < cfg.lps + 1; i++) {
+            lps.push_back(indexed_name("lp", i));
+        }
+        create_tracked_accounts(lps);
+
+        int64_t miner_stake = units(100, dmc_symbol);
+        issue(lp_miner, units(1e9, dmc_symbol), dmc_symbol);
+        seed(token_account, N(increase), lp_miner, mvo()("owner", lp_miner)("asset", ext(miner_stake, dmc_symbol))("miner", lp_miner));
+        seed(token_account, N(setmakerrate), lp_miner, mvo()("owner", lp_miner)("rate", 0.2));
+
+        int64_t lp_stake = 0;
+        for (uint64_t i = 0; i < cfg.lps; i++) {
+            int64_t stake = (miner_stake + lp_stake) / 100 + 1;
+            if (miner_stake * 3 < lp_stake + stake) {
+                int64_t top_up = (lp_stake + stake) / 2 - miner_stake;
+                seed(token_account, N(increase), lp_miner, mvo()("owner", lp_miner)("asset", ext(top_up, dmc_symbol))("miner", lp_miner));
+                miner_stake += top_up;
+                stake = (miner_stake + lp_stake) / 100 + 1;
+            }
+            issue(lps[i], stake * 2, dmc_symbol);
+            seed(token_account, N(increase), lps[i], mvo()("owner", lps[i])("asset", ext(stake, dmc_symbol))("miner", lp_miner));
+            lp_stake += stake;
+        }
+        // the unstaked partner measured below
+        issue(lps.back(), (miner_stake + lp_stake) / 10, dmc_symbol);
+        lp_total = miner_stake + lp_stake;
+    }
+
+    void seed_market() {
+        seed(token_account, N(addreserves), system_account, mvo()
+            ("owner", system_account)
+            ("x", ext(units(1000000, rsi_symbol), rsi_symbol))
+            ("y", ext(units(1000000, dmc_symbol), dmc_symbol)));
+    }
+
+    const bench_config cfg;
+    std::vector<account_name> miners;
+    std::vector<account_name> users;
+    std::vector<account_name> bill_owners;
+    std::vector<account_name> order_owners;
+    std::vector<account_name> order_miners;
+    account_name lp_miner;
+    std::vector<account_name> lps;
+    int64_t lp_total = 0;
+    uint64_t issued = 0;
+};
+
+void run_token(const bench_config& cfg) {
+    token_bench t(cfg);
+    t.seed_makers();
+    t.seed_orders();
+    t.seed_resting_bills();
+    t.seed_partnership();
+    t.seed_market();
+
+    const std::string scenario = "book";
+    // the cheapest resting bill, created first
+    uint64_t first_resting = cfg.orders / cfg.orders_per_bill + (cfg.orders % cfg.orders_per_bill ? 1 : 0) + 1;
+    account_name buyer = t.users[0];
+    report(t.measure(scenario, token_account, N(order), buyer, t.order_args(buyer, first_resting)));
+
+    // one claim interval later every seeded order has a period to settle
+    t.produce_block(fc::seconds(week_sec));
+    report(t.measure(scenario, token_account, N(claimorder), t.order_owners[0], mvo()
+        ("payer", t.order_owners[0])
+        ("order_id", 1)));
+
+    std::vector<uint64_t> batch;
+    for (uint64_t id = 2; id < 2 + 50 && id <= cfg.orders; id++) {
+        batch.push_back(id);
+    }
+    report(t.measure(scenario, token_account, N(claimorders), t.order_owners[0], mvo()
+        ("payer", t.order_owners[0])
+        ("order_ids", batch)));
+
+    // both sides agree on a single block tree, its root is the hash of the block
+    uint64_t challenged = cfg.orders;
+    account_name user = t.order_owners[challenged - 1];
+    account_name miner = t.order_miners[challenged - 1];
+    std::vector<char> data(1024, 'd');
+    std::string nonce = "bench";
+    auto root = fc::sha256::hash(data.data(), data.size());
+    for (auto sender : { user, miner }) {
+        t.seed(token_account, N(addmerkle), sender, mvo()
+            ("sender", sender)
+            ("order_id", challenged)
+            ("merkle_root", root)
+            ("data_block_count", 1));
+    }
+    std::vector<char> salted = data;
+    salted.insert(salted.end(), nonce.begin(), nonce.end());
+    auto reply = fc::sha256::hash(fc::sha256::hash(salted.data(), salted.size()));
+    t.seed(token_account, N(reqchallenge), user, mvo()
+        ("sender", user)
+        ("order_id", challenged)
+        ("data_id", 0)
+        ("hash_data", reply)
+        ("nonce", nonce));
+    report(t.measure(scenario, token_account, N(arbitration), miner, mvo()
+        ("sender", miner)
+        ("order_id", challenged)
+        ("data", data)
+        ("cut_merkle", std::vector<fc::sha256>())));
+
+    report(t.measure(scenario, token_account, N(liquidation), dmc_account, mvo()("memo", "bench")));
+
+    // exchange is not an action, a one hop route runs the same swap
+    report(t.measure("swap", token_account, N(exroute), buyer, mvo()
+        ("owner", buyer)
+        ("quantity", ext(units(100, dmc_symbol), dmc_symbol))
+        ("path", std::vector<fc::variant>{ mvo()("sym", rsi_symbol)("contract", system_account) })
+        ("min_to", ext(0, rsi_symbol))
+        ("memo", "bench")));
+
+    report(t.measure("partnership", token_account, N(increase), t.lps.back(), mvo()
+        ("owner", t.lps.back())
+        ("asset", ext(t.lp_total / 20, dmc_symbol))
+        ("miner", t.lp_miner)));
+    report(t.measure("partnership", token_account, N(redemption), t.lps[0], mvo()
+        ("owner", t.lps[0])
+        ("rate", 1)
+        ("miner", t.lp_miner)));
+}
+
+/**
+ * onblock is only pushed by the chain, its trace is picked from the applied transactions of the next block.
+ * The chain is brought past the activation stake with producers and the pst totals they wait for,
+ * so the block runs the whole path instead of returning at the stake check.
+ */
+void run_system(const bench_config& cfg) {
+    if (!fc::exists(contracts::system_wasm_path()) || !fc::exists(contracts::system_abi_path())) {
+        std::cerr << "dmc.system is not built, onblock skipped" << std::endl;
+        return;
+    }
+
+    bench_tester t;
+    t.tracked.insert(config::system_account_name);
+    t.create_tracked_accounts({ N(eosio.token) });
+    std::string wasm;
+    std::string abi;
+    fc::read_file_contents(contracts::system_wasm_path(), wasm);
+    fc::read_file_contents(contracts::system_abi_path(), abi);
+    std::vector<char> abi_json(abi.begin(), abi.end());
+    abi_json.push_back('\0');
+
+    // the system contract reads the DMC supply of eosio.token when it is constructed, in the layout of dmc.token
+    asset supply(units(1e10, dmc_symbol), dmc_symbol);
+    std::vector<char> stats(fc::raw::pack_size(supply) * 3 + sizeof(uint64_t));
+    fc::datastream<char*> ds(stats.data(), stats.size());
+    fc::raw::pack(ds, supply);
+    fc::raw::pack(ds, asset(supply.get_amount() * 10, dmc_symbol));
+    fc::raw::pack(ds, system_account);
+    fc::raw::pack(ds, asset(0, dmc_symbol));
+    t.set_row(N(eosio.token), system_account.to_uint64_t(), N(stats), dmc_symbol.to_symbol_code().value, stats);
+
+    // the first onblock stores the global state
+    t.deploy(config::system_account_name, std::vector<uint8_t>(wasm.begin(), wasm.end()), abi_json);
+
+    std::vector<account_name> producers;
+    for (uint64_t i = 0; i < cfg.producers; i++) {
+        producers.push_back(bench_tester::indexed_name("prod", i));
+    }
+    t.create_tracked_accounts(producers);
+    for (const auto& producer : producers) {
+        t.seed(config::system_account_name, N(regproducer), producer, mvo()
+            ("producer", producer)
+            ("producer_key", t.get_public_key(producer, "active"))
+            ("url", "")
+            ("location", 0));
+    }
+    t.produce_block();
+
+    // the pst totals of a token action wait in pendvotes for the next onblock
+    std::vector<fc::variant> votes;
+    for (uint64_t i = 0; i < producers.size(); i++) {
+        votes.push_back(mvo()("owner", producers[i])("pst_amount", int64_t(1000 + i)));
+    }
+    // pushed without seed so no block is produced before the measured one
+    t.push_action(config::system_account_name, N(setvotebatch), N(eosio.token), mvo()("votes", votes));
+
+    // voteproducer adds no stake, so the activation stake is written into the global state
+    const int64_t min_activated_stake = 150000000ll * 10000;
+    auto global = t.get_row(config::system_account_name, config::system_account_name.to_uint64_t(), N(global), N(global).to_uint64_t(), "eosio_global_state");
+    BOOST_REQUIRE(!global.is_null());
+    fc::mutable_variant_object state(global.get_object());
+    state("total_activated_stake", min_activated_stake);
+    t.set_row(config::system_account_name, config::system_account_name.to_uint64_t(), N(global), N(global).to_uint64_t(), "eosio_global_state", fc::variant(state));
+
+    transaction_trace_ptr onblock_trace;
+    auto conn = t.control->applied_transaction.connect([&](std::tuple<const transaction_trace_ptr&, const signed_transaction&> x) {
+        const auto& trace = std::get<0>(x);
+        if (!trace->action_traces.empty() && trace->action_traces[0].act.name == N(onblock))
+            onblock_trace = trace;
+    });
+    int64_t ram_before = t.tracked_ram();
+    t.produce_block();
+    conn.disconnect();
+    if (!onblock_trace)
+        return;
+    if (onblock_trace->except) {
+        std::cerr << "onblock failed: " << onblock_trace->except->to_detail_string() << std::endl;
+        return;
+    }
+
+    auto r = bench_tester::result_of("system", "onblock", onblock_trace);
+    r.ram_delta = t.tracked_ram() - ram_before;
+    report(r);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bench_config cfg;
+    uint64_t divisor = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            divisor = std::max<uint64_t>(std::strtoull(argv[++i], nullptr, 10), 1);
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--scale N]" << std::endl;
+            return 1;
+        }
+    }
+    if (divisor > 1)
+        cfg.scale(divisor);
+
+    try {
+        run_token(cfg);
+        run_system(cfg);
+    } catch (const fc::exception& e) {
+        std::cerr << e.to_detail_string() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -6,6 +6,7 @@ function usage() {
   -e DIR      Directory where EOSIO is installed. (Default: $HOME/eosio/X.Y)
   -c DIR      Directory where EOSIO.CDT is installed. (Default: /usr/local/eosio.cdt)
   -t          Build unit tests.
+  -b          Build the contract benchmarks.
   -y          Noninteractive mode (Uses defaults for each prompt.)
   -h          Print this help menu.
    \\n" "$0" 1>&2
@@ -13,11 +14,12 @@ function usage() {
 }
 
 BUILD_TESTS=false
+BUILD_BENCHMARKS=false
 NONINTERACTIVE=true
 PROCEED=true
 
 if [ $# -ne 0 ]; then
-  while getopts "e:c:tyh" opt; do
+  while getopts "e:c:tbyh" opt; do
     case "${opt}" in
       e )
         EOSIO_DIR_PROMPT=$OPTARG
@@ -28,6 +30,9 @@ if [ $# -ne 0 ]; then
       t )
         BUILD_TESTS=true
       ;;
+      b )
+        BUILD_BENCHMARKS=true
+      ;;
       y )
         NONINTERACTIVE=true
         PROCEED=true
@@ -54,7 +59,7 @@ fi
 . ./scripts/.environment
 . ./scripts/helper.sh
 
-if [[ ${BUILD_TESTS} == true ]]; then
+if [[ ${BUILD_TESTS} == true || ${BUILD_BENCHMARKS} == true ]]; then
    # Prompt user for location of eosio.
    eosio-directory-prompt
 fi
@@ -66,7 +71,7 @@ cdt-directory-prompt
 echo "Using EOSIO.CDT installation at: $CDT_INSTALL_DIR"
 export CMAKE_FRAMEWORK_PATH="${CDT_INSTALL_DIR}:${CMAKE_FRAMEWORK_PATH}"
 
-if [[ ${BUILD_TESTS} == true ]]; then
+if [[ ${BUILD_TESTS} == true || ${BUILD_BENCHMARKS} == true ]]; then
    # Ensure eosio version is appropriate.
    nodeos-version-check
 
@@ -81,6 +86,6 @@ NC='\033[0m'
 CPU_CORES=$(getconf _NPROCESSORS_ONLN)
 mkdir -p build
 pushd build &> /dev/null
-cmake -DBUILD_TESTS=${BUILD_TESTS} ../
+cmake -DBUILD_TESTS=${BUILD_TESTS} -DBUILD_BENCHMARKS=${BUILD_BENCHMARKS} ../
 make -j $CPU_CORES
 popd &> /dev/null
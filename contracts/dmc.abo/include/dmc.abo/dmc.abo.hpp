@@ -3,7 +3,9 @@
  *  @copyright defined in dmc/LICENSE.txt
  */
 #pragma once
+#include <map>
 #include <string>
+#include <utility>
 #include <eosiolib/eosio.hpp>
 #include <eosiolib/asset.hpp>
 #include <eosiolib/crypto.h>
@@ -16,6 +18,7 @@ namespace eosio {
 
 static constexpr uint64_t retire_dalay = 3600;
 static constexpr uint64_t time_window = 1800; // 0.5 * 3600
+static constexpr uint64_t default_repurchase_items = 50;
 static const account_name system_account = N(datamall);
 
 struct extransfer {
@@ -40,9 +43,14 @@ public:
     void handle_receipt(account_name owner, extended_asset quantity);
     void handle_extransfer(account_name from, account_name to, extended_asset quantity, std::string memo);
     void repurchase(account_name owner, uint64_t seed);
+    // visits at most max_items entries of repospool, the next call goes on from where it stopped
+    void repurchasen(account_name owner, uint64_t seed, uint64_t max_items);
 
 private:
+    typedef std::pair<extended_symbol, extended_symbol> symbol_pair;
+
     bool check_uniswap(extended_symbol from, extended_symbol to);
+    bool check_uniswap_cached(std::map<symbol_pair, bool>& markets, extended_symbol from, extended_symbol to);
 
     struct currency_stats {
         account_name issuer;
@@ -102,6 +110,15 @@ private:
         indexed_by<N(bytime), const_mem_fun<repostats, uint64_t, &repostats::get_time>>>
         repo_stats;
 
+    // the bytime entry the last repurchase stopped at
+    struct repo_cursor {
+        uint64_t update_at = 0;
+        uint64_t repo_id = 0;
+
+        EOSLIB_SERIALIZE(repo_cursor, (update_at)(repo_id))
+    };
+    typedef eosio::singleton<N(repocursor), repo_cursor> repo_cursor_singleton;
+
     struct repo_id_args {
         account_name from;
         extended_asset quantity;
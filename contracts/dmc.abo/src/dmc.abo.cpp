@@ -48,22 +48,45 @@ void abo::handle_receipt(account_name owner, extended_asset quantity)
 }
 
 void abo::repurchase(account_name owner, uint64_t seed)
+{
+    repurchasen(owner, seed, default_repurchase_items);
+}
+
+void abo::repurchasen(account_name owner, uint64_t seed, uint64_t max_items)
 {
     require_auth(owner);
+    eosio_assert(max_items > 0, "invalid max items");
     repo_stats rst(_self, _self);
     auto iter = rst.get_index<N(bytime)>();
 
     auto now_time = time_point_sec(now());
     auto rtime = now_time - retire_dalay;
-    extended_asset exchange_token;
-    bool execute = false;
 
-    for (auto it = iter.begin(); it != iter.end() && it->update_at <= rtime;) {
+    repo_cursor_singleton cursor_tbl(_self, _self);
+    auto cursor = cursor_tbl.get_or_default(repo_cursor {});
+    auto it = iter.lower_bound(cursor.update_at);
+    // go on right after the last visited entry while it is still in place, otherwise from its time
+    if (cursor.repo_id) {
+        auto last = rst.find(cursor.repo_id);
+        if (last != rst.end() && last->get_time() == cursor.update_at) {
+            it = iter.iterator_to(*last);
+            it++;
+        }
+    }
+
+    // exchanges of the same pair are sent as one, so each pair is swapped and retired once per call
+    std::map<symbol_pair, bool> markets;
+    // the memo of a merged exchange is the id of the first entry in it
+    std::map<symbol_pair, std::pair<extended_asset, uint64_t>> exchanges;
+    uint64_t visited = 0;
+    for (; it != iter.end() && it->update_at <= rtime && visited < max_items; visited++) {
         auto new_seed = it->repo_id ^ seed;
         auto s_rand = new_seed % time_window;
         auto to_sym = it->to_sym;
         auto repo_id = it->repo_id;
-        exchange_token = it->balance;
+        extended_asset exchange_token = it->balance;
+        cursor.update_at = it->get_time();
+        cursor.repo_id = it->repo_id;
 
         if (now_time >= it->expiration) {
             it = iter.erase(it);
@@ -85,14 +108,29 @@ void abo::repurchase(account_name owner, uint64_t seed)
             continue;
         }
 
-        if (exchange_token.amount && check_uniswap(exchange_token.get_extended_symbol(), to_sym)) {
-            execute = true;
-            action({ _self, N(active) }, N(eosio.token), N(exchange),
-                std::make_tuple(_self, exchange_token, extended_asset(0, to_sym), 0.0, _self, uint64_to_string(repo_id)))
-                .send();
+        if (exchange_token.amount && check_uniswap_cached(markets, exchange_token.get_extended_symbol(), to_sym)) {
+            auto pair = symbol_pair(exchange_token.get_extended_symbol(), to_sym);
+            auto exchange_iter = exchanges.find(pair);
+            if (exchange_iter == exchanges.end()) {
+                exchanges.emplace(pair, std::make_pair(exchange_token, repo_id));
+            } else {
+                exchange_iter->second.first += exchange_token;
+            }
         }
     }
-    eosio_assert(execute, "Not executed.");
+
+    if (it == iter.end() || it->update_at > rtime) {
+        // the due part of the pool is done, the next call starts over
+        cursor = repo_cursor {};
+    }
+    cursor_tbl.set(cursor, _self);
+    eosio_assert(visited > 0, "Not executed.");
+
+    for (const auto& exchange : exchanges) {
+        action({ _self, N(active) }, N(eosio.token), N(exchange),
+            std::make_tuple(_self, exchange.second.first, extended_asset(0, exchange.first.second), 0.0, _self, uint64_to_string(exchange.second.second)))
+            .send();
+    }
 }
 
 bool abo::check_uniswap(extended_symbol from, extended_symbol to)
@@ -105,6 +143,16 @@ bool abo::check_uniswap(extended_symbol from, extended_symbol to)
     return true;
 }
 
+bool abo::check_uniswap_cached(std::map<symbol_pair, bool>& markets, extended_symbol from, extended_symbol to)
+{
+    auto pair = symbol_pair(from, to);
+    auto market_iter = markets.find(pair);
+    if (market_iter == markets.end()) {
+        market_iter = markets.emplace(pair, check_uniswap(from, to)).first;
+    }
+    return market_iter->second;
+}
+
 extern "C" {
 void apply(uint64_t receiver, uint64_t code, uint64_t action)
 {
@@ -129,7 +177,7 @@ void apply(uint64_t receiver, uint64_t code, uint64_t action)
         eosio::abo thiscontract(_self);
         switch (action) {
             EOSIO_API(eosio::abo,
-                (repurchase))
+                (repurchase)(repurchasen))
         }
     }
 }
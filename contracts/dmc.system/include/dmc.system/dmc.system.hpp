@@ -81,6 +81,18 @@ struct eosio_global_state2 {
     EOSLIB_SERIALIZE(eosio_global_state2, (new_ram_per_block)(last_ram_increase)(last_block_num)(reserved)(revision))
 };
 
+/**
+ * the vote weight of one staked unit, 2 ^ (vote_epoch / 52), computed by the first vote of every week
+ */
+struct eosio_global_state3 {
+    eosio_global_state3() { }
+
+    uint32_t vote_epoch = 0; /// weeks since block_timestamp_epoch
+    double vote_factor = 1;
+
+    EOSLIB_SERIALIZE(eosio_global_state3, (vote_epoch)(vote_factor))
+};
+
 struct producer_info {
     account_name owner;
     double total_votes = 0;
@@ -142,6 +154,46 @@ typedef eosio::multi_index<N(producers), producer_info,
 
 typedef eosio::singleton<N(global), eosio_global_state> global_state_singleton;
 typedef eosio::singleton<N(global2), eosio_global_state2> global_state2_singleton;
+typedef eosio::singleton<N(global3), eosio_global_state3> global_state3_singleton;
+
+/**
+ * the producer set proposed last, `threshold` is the lowest vote among `members`.
+ * A vote change that can not change the set leaves `dirty` unset and onblock skips the election.
+ */
+struct elected_state {
+    checksum256 schedule_hash;
+    std::vector<account_name> members; // sorted
+    double threshold = 0;
+    bool dirty = true;
+
+    EOSLIB_SERIALIZE(elected_state, (schedule_hash)(members)(threshold)(dirty))
+};
+
+typedef eosio::singleton<N(elected), elected_state> elected_state_singleton;
+
+static constexpr uint32_t max_elected_producers = 21;
+
+/**
+ * an action onblock sends to `contract` with `memo` once every `interval` seconds,
+ * the task due first is the only one read by a block
+ */
+struct maintenance_task {
+    account_name task;
+    account_name contract;
+    action_name action;
+    uint32_t interval = 0;
+    uint32_t next_run = 0;
+    std::string memo;
+
+    uint64_t primary_key() const { return task; }
+    uint64_t by_next_run() const { return next_run; }
+
+    EOSLIB_SERIALIZE(maintenance_task, (task)(contract)(action)(interval)(next_run)(memo))
+};
+
+typedef eosio::multi_index<N(maintask), maintenance_task,
+    indexed_by<N(bynextrun), const_mem_fun<maintenance_task, uint64_t, &maintenance_task::by_next_run>>>
+    maintenance_tasks;
 
 //   static constexpr uint32_t     max_inflation_rate = 5;  // 5% annual inflation
 static constexpr uint32_t seconds_per_day = 24 * 3600;
@@ -155,15 +207,33 @@ struct pst_stats {
     EOSLIB_SERIALIZE(pst_stats, (owner)(amount))
 };
 typedef eosio::multi_index<N(pststats), pst_stats> pststats;
+
+struct pst_vote {
+    account_name owner;
+    int64_t pst_amount;
+
+    uint64_t primary_key() const { return owner; }
+    EOSLIB_SERIALIZE(pst_vote, (owner)(pst_amount))
+};
+
+// the last total a producer reported in a block, onblock of the next block applies it
+typedef eosio::multi_index<N(pendvotes), pst_vote> pending_votes;
+
 class system_contract : public native {
 private:
     voters_table _voters;
     producers_table _producers;
     global_state_singleton _global;
     global_state2_singleton _global2;
+    global_state3_singleton _global3;
+    elected_state_singleton _elected;
 
     eosio_global_state _gstate;
     eosio_global_state2 _gstate2;
+    eosio_global_state3 _gstate3;
+    bool _gstate3_changed = false;
+    elected_state _estate;
+    bool _estate_changed = false;
     rammarket _rammarket;
 
 public:
@@ -242,6 +312,10 @@ public:
     // functions defined in producer_pay.cpp
     void claimrewards(const account_name& owner);
 
+    void settask(account_name task, account_name contract, action_name action, uint32_t interval, const std::string& memo);
+
+    void rmtask(account_name task);
+
     void setpriv(account_name account, uint8_t ispriv);
 
     void rmvproducer(account_name producer);
@@ -254,7 +328,13 @@ public:
     // function defined in voting.cpp
     void settotalvote(account_name owner, int64_t pst_amount);
 
+    void setvotebatch(const std::vector<pst_vote>& votes);
+
 private:
+    void defer_total_vote(account_name owner, int64_t pst_amount);
+    void flush_pending_votes();
+    void set_total_vote(account_name owner, int64_t pst_amount);
+
     // Implementation details:
 
     // defined in eosio.system.cpp
@@ -262,15 +342,23 @@ private:
     static block_timestamp current_block_time();
     void update_ram_supply();
 
+    // defined in producer_pay.cpp
+    void run_maintenance();
+    bool has_task(account_name contract, action_name action);
+
     // defined in delegate_bandwidth.cpp
     void changebw(account_name from, account_name receiver,
         asset stake_net_quantity, asset stake_cpu_quantity, bool transfer);
 
     // defined in voting.hpp
     void update_elected_producers(block_timestamp timestamp);
+    void mark_elected_dirty();
+    void check_elected_vote(const producer_info& prod, double old_votes);
     void update_votes(const account_name voter, const account_name proxy, const std::vector<account_name>& producers, bool voting);
 
     // defined in voting.cpp
+    double stake2vote(int64_t staked);
+    void apply_vote_delta(account_name producer, double delta, bool from_new_set, bool voting);
     void propagate_weight_change(const voter_info& voter);
 };
 
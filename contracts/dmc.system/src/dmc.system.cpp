@@ -14,11 +14,15 @@ system_contract::system_contract(account_name s)
     , _producers(_self, _self)
     , _global(_self, _self)
     , _global2(_self, _self)
+    , _global3(_self, _self)
+    , _elected(_self, _self)
     , _rammarket(_self, _self)
 {
     // print( "construct system\n" );
     _gstate = _global.exists() ? _global.get() : get_default_parameters();
     _gstate2 = _global2.exists() ? _global2.get() : eosio_global_state2 {};
+    _gstate3 = _global3.exists() ? _global3.get() : eosio_global_state3 {};
+    _estate = _elected.exists() ? _elected.get() : elected_state {};
 
     auto itr = _rammarket.find(S(4, RAMCORE));
 
@@ -62,6 +66,10 @@ system_contract::~system_contract()
 {
     _global.set(_gstate, _self);
     _global2.set(_gstate2, _self);
+    if (_gstate3_changed)
+        _global3.set(_gstate3, _self);
+    if (_estate_changed)
+        _elected.set(_estate, _self);
 }
 
 void system_contract::setram(uint64_t max_ram_size)
@@ -151,6 +159,7 @@ void system_contract::rmvproducer(account_name producer)
     _producers.modify(prod, 0, [&](auto& p) {
         p.deactivate();
     });
+    mark_elected_dirty();
 }
 
 void system_contract::bidname(account_name bidder, account_name newname, asset bid)
@@ -291,6 +300,6 @@ EOSIO_ABI(eosiosystem::system_contract,
     // (voteproducer)
     (regproxy)
     // producer_pay.cpp
-    (onblock)(claimrewards)
+    (onblock)(claimrewards)(settask)(rmtask)
     //
-    (settotalvote))
+    (settotalvote)(setvotebatch))
@@ -27,6 +27,9 @@ void system_contract::onblock(block_timestamp timestamp, account_name producer)
     // is eventually completely removed, at which point this line can be removed.
     _gstate2.last_block_num = timestamp;
 
+    // the pst totals of the previous block do not wait for the stake threshold
+    flush_pending_votes();
+
     /** until activated stake crosses this threshold no new rewards are paid */
     if (_gstate.total_activated_stake < min_activated_stake)
         return;
@@ -46,15 +49,22 @@ void system_contract::onblock(block_timestamp timestamp, account_name producer)
         });
     }
 
+    run_maintenance();
+
     /// only update block producers once every minute, block_timestamp is in half seconds
     if (timestamp.slot - _gstate.last_producer_schedule_update.slot > 120) {
         update_elected_producers(timestamp);
 
-        INLINE_ACTION_SENDER(eosio::token, allocation)
-        (N(eosio.token), { N(eosio), N(active) }, { "allocation" });
+        // each one until a maintenance task is registered for it
+        if (!has_task(N(eosio.token), N(allocation))) {
+            INLINE_ACTION_SENDER(eosio::token, allocation)
+            (N(eosio.token), { N(eosio), N(active) }, { "allocation" });
+        }
 
-        INLINE_ACTION_SENDER(eosio::token, liquidation)
-        (N(eosio.token), { N(eosio), N(active) }, { "liquidation" });
+        if (!has_task(N(eosio.token), N(liquidation))) {
+            INLINE_ACTION_SENDER(eosio::token, liquidation)
+            (N(eosio.token), { N(eosio), N(active) }, { "liquidation" });
+        }
 
         if ((timestamp.slot - _gstate.last_name_close.slot) > blocks_per_day) {
             name_bid_table bids(_self, _self);
@@ -70,6 +80,77 @@ void system_contract::onblock(block_timestamp timestamp, account_name producer)
     }
 }
 
+/**
+ * runs at most the one task due first, a block whose earliest task is not due reads a single row.
+ */
+void system_contract::run_maintenance()
+{
+    maintenance_tasks tasks(_self, _self);
+    auto idx = tasks.get_index<N(bynextrun)>();
+    auto it = idx.begin();
+    if (it == idx.end())
+        return;
+
+    uint32_t now_sec = now();
+    if (it->next_run > now_sec)
+        return;
+
+    eosio::action(eosio::permission_level { N(eosio), N(active) }, it->contract, it->action, it->memo).send();
+    idx.modify(it, 0, [&](auto& t) {
+        t.next_run = now_sec + t.interval;
+    });
+}
+
+// only a handful of tasks are registered, and it is read once a schedule update
+bool system_contract::has_task(account_name contract, action_name action)
+{
+    maintenance_tasks tasks(_self, _self);
+    for (const auto& t : tasks) {
+        if (t.contract == contract && t.action == action)
+            return true;
+    }
+    return false;
+}
+
+void system_contract::settask(account_name task, account_name contract, action_name action, uint32_t interval, const std::string& memo)
+{
+    require_auth(_self);
+    eosio_assert(is_account(contract), "contract does not exist");
+    eosio_assert(interval > 0, "invalid interval");
+    eosio_assert(memo.size() <= 256, "memo has more than 256 bytes");
+
+    maintenance_tasks tasks(_self, _self);
+    auto it = tasks.find(task);
+    if (it == tasks.end()) {
+        tasks.emplace(_self, [&](auto& t) {
+            t.task = task;
+            t.contract = contract;
+            t.action = action;
+            t.interval = interval;
+            t.next_run = now();
+            t.memo = memo;
+        });
+    } else {
+        tasks.modify(it, 0, [&](auto& t) {
+            t.contract = contract;
+            t.action = action;
+            // keeps the time of the last run, without going below 0
+            uint32_t last_run = t.next_run >= t.interval ? t.next_run - t.interval : 0;
+            t.next_run = last_run + interval;
+            t.interval = interval;
+            t.memo = memo;
+        });
+    }
+}
+
+void system_contract::rmtask(account_name task)
+{
+    require_auth(_self);
+    maintenance_tasks tasks(_self, _self);
+    const auto& it = tasks.get(task, "task not found");
+    tasks.erase(it);
+}
+
 using namespace eosio;
 void system_contract::claimrewards(const account_name& owner)
 {
@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 
 namespace eosiosystem {
 using eosio::bytes;
@@ -49,6 +50,7 @@ void system_contract::regproducer(const account_name producer, const eosio::publ
             info.url = url;
             info.location = location;
         });
+        mark_elected_dirty();
     } else {
         pststats pst_acnts(N(eosio.token), N(eosio.token));
         auto st = pst_acnts.find(producer);
@@ -65,6 +67,7 @@ void system_contract::regproducer(const account_name producer, const eosio::publ
             info.url = url;
             info.location = location;
         });
+        check_elected_vote(*_producers.find(producer), 0);
     }
 }
 
@@ -76,6 +79,8 @@ void system_contract::unregprod(const account_name producer)
 
     if (prod.active())
         _gstate.total_producer_pst_minted -= prod.total_votes;
+    if (std::binary_search(_estate.members.begin(), _estate.members.end(), producer))
+        mark_elected_dirty();
     _producers.erase(prod);
 }
 
@@ -83,13 +88,18 @@ void system_contract::update_elected_producers(block_timestamp block_time)
 {
     _gstate.last_producer_schedule_update = block_time;
 
+    if (!_estate.dirty)
+        return;
+
     auto idx = _producers.get_index<N(prototalvote)>();
 
     std::vector<std::pair<eosio::producer_key, uint16_t>> top_producers;
-    top_producers.reserve(21);
+    top_producers.reserve(max_elected_producers);
 
-    for (auto it = idx.cbegin(); it != idx.cend() && top_producers.size() < 21 && 0 < it->total_votes && it->active(); ++it) {
+    double threshold = 0;
+    for (auto it = idx.cbegin(); it != idx.cend() && top_producers.size() < max_elected_producers && 0 < it->total_votes && it->active(); ++it) {
         top_producers.emplace_back(std::pair<eosio::producer_key, uint16_t>({ { it->owner, it->producer_key }, it->location }));
+        threshold = it->total_votes;
     }
 
     if (top_producers.size() < _gstate.last_producer_schedule_size) {
@@ -100,23 +110,69 @@ void system_contract::update_elected_producers(block_timestamp block_time)
     std::sort(top_producers.begin(), top_producers.end());
 
     std::vector<eosio::producer_key> producers;
+    std::vector<account_name> members;
 
     producers.reserve(top_producers.size());
-    for (const auto& item : top_producers)
+    members.reserve(top_producers.size());
+    for (const auto& item : top_producers) {
         producers.push_back(item.first);
+        members.push_back(item.first.producer_name);
+    }
 
     bytes packed_schedule = pack(producers);
+    checksum256 schedule_hash;
+    sha256(packed_schedule.data(), packed_schedule.size(), &schedule_hash);
+
+    _estate.members = members;
+    _estate.threshold = threshold;
+    _estate.dirty = false;
+    _estate_changed = true;
+    if (memcmp(&schedule_hash, &_estate.schedule_hash, sizeof(checksum256)) == 0)
+        return;
 
     if (set_proposed_producers(packed_schedule.data(), packed_schedule.size()) >= 0) {
         _gstate.last_producer_schedule_size = static_cast<decltype(_gstate.last_producer_schedule_size)>(top_producers.size());
+        _estate.schedule_hash = schedule_hash;
+    } else {
+        // try again in the next round, as before
+        _estate.dirty = true;
+    }
+}
+
+void system_contract::mark_elected_dirty()
+{
+    if (_estate.dirty)
+        return;
+    _estate.dirty = true;
+    _estate_changed = true;
+}
+
+// marks the set dirty when the new vote of prod may move it in or out of the elected set
+void system_contract::check_elected_vote(const producer_info& prod, double old_votes)
+{
+    if (_estate.dirty || prod.total_votes == old_votes)
+        return;
+
+    if (std::binary_search(_estate.members.begin(), _estate.members.end(), prod.owner)) {
+        // a member whose vote grows stays in the set
+        if (prod.total_votes < old_votes)
+            mark_elected_dirty();
+    } else if (prod.active() && prod.total_votes > 0 && (_estate.members.size() < max_elected_producers || prod.total_votes >= _estate.threshold)) {
+        // a tie with the lowest member can win the ordering by owner, so it marks the set dirty too
+        mark_elected_dirty();
     }
 }
 
-double stake2vote(int64_t staked)
+double system_contract::stake2vote(int64_t staked)
 {
     /// TODO subtract 2080 brings the large numbers closer to this decade
-    double weight = int64_t((now() - (block_timestamp::block_timestamp_epoch / 1000)) / (seconds_per_day * 7)) / double(52);
-    return double(staked) * std::pow(2, weight);
+    uint32_t epoch = uint32_t((now() - (block_timestamp::block_timestamp_epoch / 1000)) / (seconds_per_day * 7));
+    if (epoch != _gstate3.vote_epoch) {
+        _gstate3.vote_epoch = epoch;
+        _gstate3.vote_factor = std::pow(2, epoch / double(52));
+        _gstate3_changed = true;
+    }
+    return double(staked) * _gstate3.vote_factor;
 }
 /**
  *  @pre producers must be sorted from lowest to highest and must be registered and active
@@ -176,7 +232,6 @@ void system_contract::update_votes(const account_name voter_name, const account_
         new_vote_weight += voter->proxied_vote_weight;
     }
 
-    boost::container::flat_map<account_name, pair<double, bool /*new*/>> producer_deltas;
     if (voter->last_vote_weight > 0) {
         if (voter->proxy) {
             auto old_proxy = _voters.find(voter->proxy);
@@ -185,12 +240,6 @@ void system_contract::update_votes(const account_name voter_name, const account_
                 vp.proxied_vote_weight -= voter->last_vote_weight;
             });
             propagate_weight_change(*old_proxy);
-        } else {
-            for (const auto& p : voter->producers) {
-                auto& d = producer_deltas[p];
-                d.first -= voter->last_vote_weight;
-                d.second = false;
-            }
         }
     }
 
@@ -204,32 +253,22 @@ void system_contract::update_votes(const account_name voter_name, const account_
             });
             propagate_weight_change(*new_proxy);
         }
-    } else {
-        if (new_vote_weight >= 0) {
-            for (const auto& p : producers) {
-                auto& d = producer_deltas[p];
-                d.first += new_vote_weight;
-                d.second = true;
-            }
-        }
     }
 
-    for (const auto& pd : producer_deltas) {
-        auto pitr = _producers.find(pd.first);
-        if (pitr != _producers.end()) {
-            eosio_assert(!voting || pitr->active() || !pd.second.second /* not from new set */, "producer is not currently registered");
-            _producers.modify(pitr, 0, [&](auto& p) {
-                p.total_votes += pd.second.first;
-                if (p.total_votes < 0) { // floating point arithmetics can give small negative numbers
-                    p.total_votes = 0;
-                }
-                // -------   dmc -------
-                // _gstate.total_producer_pst_minted += pd.second.first;
-                // ------- dmc end -----
-                // eosio_assert( p.total_votes >= 0, "something bad happened" );
-            });
+    // both lists are sorted, walking them together modifies each producer once
+    const std::vector<account_name> none;
+    const auto& old_producers = (voter->last_vote_weight > 0 && !voter->proxy) ? voter->producers : none;
+    const auto& new_producers = (!proxy && new_vote_weight >= 0) ? producers : none;
+    auto old_it = old_producers.begin();
+    auto new_it = new_producers.begin();
+    while (old_it != old_producers.end() || new_it != new_producers.end()) {
+        if (new_it == new_producers.end() || (old_it != old_producers.end() && *old_it < *new_it)) {
+            apply_vote_delta(*old_it++, -voter->last_vote_weight, false, voting);
+        } else if (old_it == old_producers.end() || *new_it < *old_it) {
+            apply_vote_delta(*new_it++, new_vote_weight, true, voting);
         } else {
-            eosio_assert(!pd.second.second /* not from new set */, "producer is not registered"); // data corruption
+            apply_vote_delta(*new_it++, new_vote_weight - voter->last_vote_weight, true, voting);
+            ++old_it;
         }
     }
 
@@ -240,6 +279,26 @@ void system_contract::update_votes(const account_name voter_name, const account_
     });
 }
 
+// `from_new_set` is set when the voter still or newly votes for producer
+void system_contract::apply_vote_delta(account_name producer, double delta, bool from_new_set, bool voting)
+{
+    auto pitr = _producers.find(producer);
+    if (pitr == _producers.end()) {
+        eosio_assert(!from_new_set, "producer is not registered"); // data corruption
+        return;
+    }
+    eosio_assert(!voting || pitr->active() || !from_new_set, "producer is not currently registered");
+
+    double old_votes = pitr->total_votes;
+    _producers.modify(pitr, 0, [&](auto& p) {
+        p.total_votes += delta;
+        if (p.total_votes < 0) { // floating point arithmetics can give small negative numbers
+            p.total_votes = 0;
+        }
+    });
+    check_elected_vote(*pitr, old_votes);
+}
+
 /**
  *  An account marked as a proxy can vote with the weight of other accounts which
  *  have selected it as a proxy. Other accounts must refresh their voteproducer to
@@ -289,12 +348,14 @@ void system_contract::propagate_weight_change(const voter_info& voter)
             auto delta = new_weight - voter.last_vote_weight;
             for (auto acnt : voter.producers) {
                 auto& pitr = _producers.get(acnt, "producer not found"); // data corruption
+                double old_votes = pitr.total_votes;
                 _producers.modify(pitr, 0, [&](auto& p) {
                     p.total_votes += delta;
                     // -------   dmc -------
                     // _gstate.total_producer_pst_minted += delta;
                     // ------- dmc end -----
                 });
+                check_elected_vote(pitr, old_votes);
             }
         }
     }
@@ -306,15 +367,64 @@ void system_contract::propagate_weight_change(const voter_info& voter)
 void system_contract::settotalvote(account_name owner, int64_t pst_amount)
 {
     require_auth(N(eosio.token));
+    eosio_assert(pst_amount >= 0, "invalid pst amount");
+    defer_total_vote(owner, pst_amount);
+}
+
+// the totals of every owner whose PST changed in one token action
+void system_contract::setvotebatch(const std::vector<pst_vote>& votes)
+{
+    require_auth(N(eosio.token));
+    for (const auto& vote : votes) {
+        eosio_assert(vote.pst_amount >= 0, "invalid pst amount");
+        defer_total_vote(vote.owner, vote.pst_amount);
+    }
+}
+
+// the owners that are not producers have no row to update
+void system_contract::defer_total_vote(account_name owner, int64_t pst_amount)
+{
+    if (_producers.find(owner) == _producers.end())
+        return;
+
+    pending_votes pending(_self, _self);
+    auto it = pending.find(owner);
+    if (it == pending.end()) {
+        pending.emplace(_self, [&](auto& v) {
+            v.owner = owner;
+            v.pst_amount = pst_amount;
+        });
+    } else {
+        pending.modify(it, 0, [&](auto& v) {
+            v.pst_amount = pst_amount;
+        });
+    }
+}
+
+// one row per producer at most, so a block applies all of them
+void system_contract::flush_pending_votes()
+{
+    pending_votes pending(_self, _self);
+    for (auto it = pending.begin(); it != pending.end();) {
+        // a row written before the amounts were checked is dropped
+        if (it->pst_amount >= 0)
+            set_total_vote(it->owner, it->pst_amount);
+        it = pending.erase(it);
+    }
+}
+
+void system_contract::set_total_vote(account_name owner, int64_t pst_amount)
+{
     auto prod = _producers.find(owner);
 
     if (prod != _producers.end()) {
         double old_total = prod->total_votes;
-        _gstate.total_producer_pst_minted += (pst_amount - old_total);
-        eosio_assert(_gstate.total_producer_pst_minted >= 0, "invalid pst_minted"); // never happen
+        // onblock applies this, so a sum out of line with the votes is clamped instead of failing every block
+        _gstate.total_producer_pst_minted = std::max(_gstate.total_producer_pst_minted + (pst_amount - old_total), 0.0);
         _producers.modify(prod, 0, [&](producer_info& info) {
             info.total_votes = pst_amount;
         });
+        check_elected_vote(*prod, old_total);
     }
 }
 } /// namespace eosiosystem
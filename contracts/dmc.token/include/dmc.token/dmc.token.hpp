@@ -9,9 +9,16 @@
 #include <eosio/eosio.hpp>
 #include <eosio/time.hpp>
 #include <eosio/crypto.hpp>
+#include <eosio/binary_extension.hpp>
+#include <dmc.token/fixed_point.hpp>
+#include <dmc.token/profile.hpp>
 
 #include <string>
+#include <string.h>
 #include <cmath>
+#include <map>
+#include <set>
+#include <tuple>
 
 namespace eosio {
 
@@ -19,7 +26,9 @@ using std::string;
 
 static const name dmc_account = "dmc"_n;
 constexpr double static_weights = 10000.0;
-constexpr double uniswap_fee = 0.003;
+// 0.3%
+constexpr uint64_t uniswap_fee_per_mille = 3;
+constexpr uint64_t max_route_hops = 5;
 constexpr uint64_t uint64_max = ~uint64_t(0);
 constexpr uint32_t uint32_max = ~uint32_t(0);
 constexpr uint64_t minimum_token_precision = 0;
@@ -69,6 +78,28 @@ constexpr uint64_t default_penalty_rate = 30;
 
 constexpr uint64_t default_bill_num_limit = 10;
 
+// lock tranches sharing an hour are kept in one row
+constexpr uint64_t lock_bucket_sec = 3600;
+
+// penalties are released over 12 hourly slots
+constexpr uint64_t penalty_slot_count = 12;
+constexpr uint64_t penalty_slot_sec = 3600;
+
+// orders settled by one claimorders call
+constexpr uint64_t max_claim_orders = 50;
+
+// work budget of one liquidation call
+constexpr uint64_t default_liquidation_maker_limit = 20;
+constexpr uint64_t default_liquidation_bill_limit = 50;
+
+// layout version of token::events and the records it carries, see README.md
+constexpr uint16_t event_version = 2;
+
+// nft ids take the low 40 bits of a holding key, symbol ids the high 24 bits
+constexpr uint64_t nft_id_bits = 40;
+constexpr uint64_t max_nft_symbol_id = (uint64_t(1) << (64 - nft_id_bits)) - 1;
+constexpr uint64_t max_nft_id = (uint64_t(1) << nft_id_bits) - 1;
+
 // for abo
 static const name abo_account = "dmfoundation"_n;
 
@@ -154,6 +185,7 @@ enum e_maker_receipt_type {
 enum e_maker_distribute_type {
     MakerDistributeAccount = 1,
     MakerDistributePool = 2,
+    MakerDistributeIndex = 3, // shared by weight through maker_reward
 };
 
 enum e_price_range_type {
@@ -180,21 +212,47 @@ typedef uint8_t MakerDistributeType;
 typedef uint8_t PriceRangeType;
 typedef uint8_t AllocationType;
 
+/**
+ * queue a record action of CONTRACT, all records of an action are sent as one token::events at the end of it,
+ * EMIT_EVENT(*this, orderrec, {order_info, 1}) takes the same arguments as SEND_INLINE_ACTION without the permissions
+ */
+#define EMIT_EVENT(CONTRACT, NAME, ...) \
+    (CONTRACT).emit_event<decltype(&std::decay_t<decltype(CONTRACT)>::NAME)>(BOOST_PP_CAT(BOOST_PP_STRINGIZE(NAME), _n), __VA_ARGS__)
+
 CONTRACT token : public contract {
 
 public:
     token(name receiver, name code, datastream<const char*> ds);
+    ~token();
 
     struct nft_batch_args {
         uint64_t nft_id;
         extended_asset quantity;
     };
 
+    // one entry of nftbatchrec, `balance` is what `owner` holds after the batch
+    struct nft_balance_change {
+        uint64_t nft_id;
+        name owner;
+        int64_t delta;
+        int64_t balance;
+    };
+
     struct asset_type_args {
         extended_asset quant;
         uint8_t type;
     };
 
+    /**
+     * one record of token::events, `type` is the name of a record action (orderrec, billsnap, ...)
+     * and `data` is the argument list of that action serialized as the action itself would be,
+     * so it decodes with the abi of the record action it stands for
+     */
+    struct event_record {
+        name type;
+        std::vector<char> data;
+    };
+
 public:
 
     ACTION create(name issuer, asset max_supply);
@@ -223,6 +281,9 @@ public:
 
     void exchange(name owner, extended_asset quantity, extended_asset to, double price, name id, string memo);
 
+    // sells quantity along path, each entry is the symbol received from the next market
+    ACTION exroute(name owner, extended_asset quantity, std::vector<extended_symbol> path, extended_asset min_to, string memo);
+
     ACTION exdestroy(extended_symbol sym);
 
 public:
@@ -231,6 +292,8 @@ public:
 
     ACTION exunlock(name owner, extended_asset quantity, time_point_sec expiration, string memo);
 
+    ACTION exunlockall(name owner, extended_symbol sym, string memo);
+
     ACTION exlock(name from, extended_asset quantity, time_point_sec expiration, string memo);
 
 public:
@@ -245,11 +308,50 @@ public:
 
     ACTION unbill(name owner, uint64_t bill_id, string memo);
 
+    // also swaps all the incentive the owner's bills accrued to DMC and adds it to the stake
     ACTION getincentive(name owner, uint64_t bill_id);
 
+    // swaps the incentive accrued so far without a bill, e.g. after the last bill is gone
+    ACTION settleincent(name owner);
+
     ACTION setabostats(uint64_t stage, double user_rate, double foundation_rate, extended_asset total_release, extended_asset remaining_release, time_point_sec start_at, time_point_sec end_at, time_point_sec last_released_at);
 
     ACTION order(name owner, uint64_t bill_id, uint64_t benchmark_price, PriceRangeType price_range, uint64_t epoch, extended_asset asset, extended_asset reserve, string memo);
+
+    /**
+     * index bills created before the price level book existed, at most `limit` bills per call.
+     * bill / unbill / order stay closed until every bill has been indexed.
+     */
+    ACTION bookmigrate(uint64_t limit);
+
+    /**
+     * move at most `limit` bills from billrec to the bills table,
+     * bill / unbill / order stay closed until billrec is empty.
+     */
+    ACTION billmigrate(uint64_t limit);
+
+    /**
+     * move at most `limit` rows of the legacy price history into the rolling median,
+     * order stays closed until the legacy history is empty.
+     */
+    ACTION pricemigrate(uint64_t limit);
+
+    /**
+     * move at most `limit` orders of the legacy dmcorder table into the cold and hot order tables
+     */
+    ACTION ordermigrate(uint64_t limit);
+
+    /**
+     * add at most `limit` orders stored before the phishing pool existed to it
+     */
+    ACTION phishmigrate(uint64_t limit);
+
+    /**
+     * move at most `limit` bills of the legacy per-owner scope of billrec to the bills table,
+     * those bills can not be unbilled or ordered until their owner is migrated,
+     * the owner or the config account can run it
+     */
+    ACTION migrateobill(name owner, uint64_t limit);
     
     ACTION setreserve(name owner, extended_asset dmc_quantity, extended_asset rsi_quantity);
 
@@ -261,6 +363,9 @@ public:
 
     ACTION redemption(name owner, double rate, name miner);
 
+    // pays the order rewards owed to the position of `owner` in the maker pool of `miner`
+    ACTION getlpreward(name owner, name miner);
+
     ACTION mint(name owner, extended_asset asset);
 
     ACTION setmakerrate(name owner, double rate);
@@ -269,6 +374,8 @@ public:
 
     ACTION liquidation(string memo);
 
+    ACTION runliq(name keeper);
+
     ACTION addmerkle(name sender, uint64_t order_id, checksum256 merkle_root, uint64_t data_block_count);
 
     ACTION reqchallenge(name sender, uint64_t order_id, uint64_t data_id, checksum256 hash_data, std::string nonce);
@@ -283,6 +390,12 @@ public:
 
     ACTION claimorder(name payer, uint64_t order_id);
 
+    /**
+     * claim every order of `order_ids` at once, the rsi of all orders is exchanged in one swap
+     * and each account is credited once
+     */
+    ACTION claimorders(name payer, std::vector<uint64_t> order_ids);
+
     ACTION claimdeposit(name payer, uint64_t order_id);
 
     ACTION addordasset(name sender, uint64_t order_id, extended_asset quantity);
@@ -308,13 +421,14 @@ public:
     ACTION burnbatch(name from, std::vector<nft_batch_args> batch_args);
 
 private:
-    void uniswaporder(name owner, extended_asset quantity, extended_asset to, double price, name id, name rampay);
+    void uniswaporder(name owner, extended_asset quantity, extended_asset to, name id, name rampay);
     double get_real_asset(extended_asset quantity);
 
     template <typename T, T (*wipe_function)(T)>
     extended_asset get_asset_by_amount(T amount, extended_symbol symbol);
 
-    void uniswapdeal(name owner, extended_asset& market_from, extended_asset& market_to, extended_asset from, extended_asset to_sym, uint64_t primary, double price, name rampay);
+    void uniswapdeal(name owner, extended_asset& market_from, extended_asset& market_to, extended_asset from, extended_asset to_sym, uint64_t primary, name rampay);
+    extended_asset uniswap_swap(extended_asset& market_from, extended_asset& market_to, extended_asset from, extended_asset to, extended_asset& spread_from, extended_asset& to_fee);
 
     extended_asset exchange_from_uniswap(extended_asset add_balance);
 
@@ -326,6 +440,7 @@ private:
     extended_asset get_dmc_by_vrsi(extended_asset rsi_quantity);
 
     extended_asset allocation_abo(time_point_sec now_time);
+    extended_asset release_abo(time_point_sec now_time, bool user, uint64_t min_interval);
 
     extended_asset allocation_penalty(time_point_sec now_time);
 
@@ -338,8 +453,10 @@ public:
     ACTION uniswapsnap(name owner, extended_asset quantity);
     
 public:
+    // bill_id is 0 when the incentive is settled without a bill
     ACTION incentiverec(name owner, extended_asset inc, uint64_t bill_id);
     ACTION redeemrec(name owner, name miner, extended_asset asset);
+    ACTION lprewardrec(name owner, name miner, extended_asset reward);
     ACTION liqrec(name miner, extended_asset pst_asset, extended_asset dmc_asset);
     ACTION billliqrec(name miner, uint64_t bill_id, extended_asset sub_pst);
     ACTION currliqrec(name miner, extended_asset sub_pst);
@@ -348,6 +465,7 @@ public:
     ACTION nftsymrec(uint64_t symbol_id, extended_symbol nft_symbol, std::string symbol_uri, nft_type type);
     ACTION nftrec(uint64_t symbol_id, uint64_t nft_id, std::string nft_uri, std::string nft_name, std::string extra_data, extended_asset quantity);
     ACTION nftaccrec(uint64_t symbol_id, uint64_t nft_id, name owner, extended_asset quantity);
+    ACTION nftbatchrec(uint64_t symbol_id, extended_symbol nft_symbol, std::vector<nft_balance_change> changes);
     ACTION allocrec(extended_asset quantity, AllocationType type);
     ACTION innerswaprec(extended_asset vrsi, extended_asset dmc);
 public:
@@ -364,14 +482,31 @@ private:
      */
     void sub_stats(extended_asset quantity);
 
-    void trace_price_history(double price, uint64_t bill_id, uint64_t order_id);
+    void trace_price_history(uint64_t price);
 
     ChallengeState get_challenge_state(uint64_t order_id);
     bool is_challenge_end(ChallengeState state);
 
 private:
+    /**
+     * dmcconfig rows read or written by this action,
+     * each key is read from the table at most once and written back once in the destructor
+     */
+    struct dmc_config_cache {
+        uint64_t value;
+        bool exists;
+        bool dirty;
+    };
+    std::map<uint64_t, dmc_config_cache> _config_cache;
+
     uint64_t get_dmc_config(name key, uint64_t default_value);
     void set_dmc_config(name key, uint64_t value);
+    void flush_dmc_config();
+
+    // the benchmark price of this action, read at most once and kept in step by trace_price_history
+    double _benchmark_price = 0;
+    bool _benchmark_price_loaded = false;
+
     double get_dmc_rate(uint64_t rate_value);
     double get_benchmark_price();
 
@@ -427,6 +562,23 @@ public:
         indexed_by<"ownerid"_n, const_mem_fun<nft_balance, uint128_t, &nft_balance::by_owner_id>>>
         nft_balances;
 
+    /**
+     * nft balances scoped by owner, keyed by symbol id and nft id so no secondary index is needed,
+     * a row is erased when its amount gets to 0. A nftbalance row is moved here when it is first used.
+     */
+    TABLE nft_holding {
+        uint64_t symbol_id;
+        uint64_t nft_id;
+        int64_t amount;
+
+        uint64_t primary_key() const { return get_key(symbol_id, nft_id); }
+        static uint64_t get_key(uint64_t symbol_id, uint64_t nft_id)
+        {
+            return (symbol_id << nft_id_bits) + nft_id;
+        }
+    };
+    typedef eosio::multi_index<"nftholding"_n, nft_holding> nft_holdings;
+
     TABLE account {
         uint64_t primary;
         extended_asset balance;
@@ -437,12 +589,26 @@ public:
             return ((uint128_t(symbol.get_symbol().code().raw()) << 64) + symbol.get_contract().value);
         }
         uint128_t get_key() const { return key(balance.get_extended_symbol()); }
+        // primary key of accountsv2, the first 8 bytes of sha256(symbol code, contract)
+        static uint64_t hashed_key(const extended_symbol& symbol)
+        {
+            uint64_t data[2] = { symbol.get_symbol().code().raw(), symbol.get_contract().value };
+            auto hash = sha256((const char*)data, sizeof(data)).extract_as_byte_array();
+            uint64_t value;
+            memcpy(&value, hash.data(), sizeof(value));
+            return value;
+        }
     };
 
     typedef eosio::multi_index<"accounts"_n, account,
         indexed_by<"byextendedas"_n, const_mem_fun<account, uint128_t, &account::get_key>>>
         accounts;
 
+    /**
+     * balances found by one primary key lookup, a row of accounts is moved here when it is first used
+     */
+    typedef eosio::multi_index<"accountsv2"_n, account> accounts_v2;
+
     TABLE lock_account {
         uint64_t primary;
         extended_asset balance;
@@ -455,12 +621,35 @@ public:
             return checksum256::make_from_word_sequence<uint64_t>(symbol.get_symbol().code().raw(), symbol.get_contract().value, uint64_t(lock_timestamp.sec_since_epoch()));
         }
         checksum256 get_key() const { return key(balance.get_extended_symbol(), lock_timestamp); }
+
+        // locks are merged per hour, rounded up so that nothing unlocks early, 0 and the permanent lock are kept
+        static time_point_sec bucket(time_point_sec lock_timestamp)
+        {
+            uint64_t t = lock_timestamp.sec_since_epoch();
+            if (t == 0 || t >= uint32_max - (uint32_max % lock_bucket_sec))
+                return lock_timestamp;
+            return time_point_sec((t + lock_bucket_sec - 1) / lock_bucket_sec * lock_bucket_sec);
+        }
     };
 
     typedef eosio::multi_index<"lockaccounts"_n, lock_account,
         indexed_by<"byextendedas"_n, const_mem_fun<lock_account, checksum256, &lock_account::get_key>>>
         lock_accounts;
 
+    // locked total and earliest lock of a symbol in an owner's lockaccounts
+    TABLE lock_summary {
+        uint64_t primary;
+        extended_asset balance;
+        time_point_sec earliest_unlock;
+
+        uint64_t primary_key() const { return primary; }
+        uint128_t get_key() const { return account::key(balance.get_extended_symbol()); }
+    };
+
+    typedef eosio::multi_index<"locksummary"_n, lock_summary,
+        indexed_by<"byextendedas"_n, const_mem_fun<lock_summary, uint128_t, &lock_summary::get_key>>>
+        lock_summaries;
+
     TABLE currency_stats {
         asset supply;
         asset max_supply;
@@ -543,6 +732,11 @@ public:
         uint64_t get_unmatched() const { return unmatched.quantity.amount; }
         uint64_t get_time() const { return uint64_t(updated_at.sec_since_epoch()); }
         uint64_t by_expire() const { return uint64_t(expire_on.sec_since_epoch()); }
+        static uint128_t get_price_capacity(uint64_t price, uint64_t unmatched)
+        {
+            return ((uint128_t(price) << 64) + unmatched);
+        }
+        uint128_t by_price_capacity() const { return get_price_capacity(price, unmatched.quantity.amount); }
     };
     typedef eosio::multi_index<"billrec"_n, bill_record,
         indexed_by<"bylowerprice"_n, const_mem_fun<bill_record, uint64_t, &bill_record::get_lower>>,
@@ -550,9 +744,33 @@ public:
         indexed_by<"byratio"_n, const_mem_fun<bill_record, uint64_t, &bill_record::get_ratio>>,
         indexed_by<"bycunmatched"_n, const_mem_fun<bill_record, uint64_t, &bill_record::get_unmatched>>,
         indexed_by<"bytime"_n, const_mem_fun<bill_record, uint64_t, &bill_record::get_time>>,
-        indexed_by<"byexpire"_n, const_mem_fun<bill_record, uint64_t, &bill_record::by_expire>>>
+        indexed_by<"byexpire"_n, const_mem_fun<bill_record, uint64_t, &bill_record::by_expire>>,
+        indexed_by<"bypricecap"_n, const_mem_fun<bill_record, uint128_t, &bill_record::by_price_capacity>>>
         bill_stats;
 
+    /**
+     * the open bills once moved out of billrec, only the indices read on chain are kept:
+     * byowner for liquidation and bypricecap for matching. The other orderings are left to the
+     * trackers of billsnap, which is emitted on every change of a bill.
+     */
+    typedef eosio::multi_index<"bills"_n, bill_record,
+        indexed_by<"byowner"_n, const_mem_fun<bill_record, uint64_t, &bill_record::get_owner>>,
+        indexed_by<"bypricecap"_n, const_mem_fun<bill_record, uint128_t, &bill_record::by_price_capacity>>>
+        bill_table;
+
+    /**
+     * aggregate of the open bills at one price,
+     * order skips a whole price level with one read instead of walking its bills
+     */
+    TABLE bill_price_level {
+        uint64_t price;
+        extended_asset unmatched;
+        uint64_t bill_count;
+
+        uint64_t primary_key() const { return price; }
+    };
+    typedef eosio::multi_index<"billlevel"_n, bill_price_level> bill_levels;
+
     TABLE pst_stats {
         name owner;
         extended_asset amount;
@@ -572,12 +790,26 @@ public:
         time_point_sec end_at;
         time_point_sec last_user_released_at;
         time_point_sec last_foundation_released_at;
+        // what each side has still to release, split from remaining_release on first use for older rows
+        binary_extension<int64_t> user_remaining;
+        binary_extension<int64_t> foundation_remaining;
 
         uint64_t primary_key() const { return stage; }
-        EOSLIB_SERIALIZE(abo_stats, (stage)(user_rate)(foundation_rate)(total_release)(remaining_release)(start_at)(end_at)(last_user_released_at)(last_foundation_released_at))
+        EOSLIB_SERIALIZE(abo_stats, (stage)(user_rate)(foundation_rate)(total_release)(remaining_release)(start_at)(end_at)(last_user_released_at)(last_foundation_released_at)(user_remaining)(foundation_remaining))
     };
     typedef eosio::multi_index<"abostats"_n, abo_stats> abostats;
 
+    /**
+     * the first stage each side has not finished releasing, stages before it are never read again
+     */
+    TABLE abo_cursor {
+        uint64_t user_stage;
+        uint64_t foundation_stage;
+
+        uint64_t primary_key() const { return 0; }
+    };
+    typedef eosio::multi_index<"abocursor"_n, abo_cursor> abo_cursor_table;
+
     TABLE penalty_stats {
         time_point_sec start_at;
         time_point_sec end_at;
@@ -588,6 +820,20 @@ public:
     };
     typedef eosio::multi_index<"penaltystats"_n, penalty_stats> penaltystats;
 
+    /**
+     * ring of the hourly penalty release slots, slots[head] ends at head_end and is released
+     * linearly from released_at, slots[(head + i) % penalty_slot_count] ends i hours later
+     */
+    TABLE penalty_schedule {
+        time_point_sec head_end;
+        time_point_sec released_at;
+        uint64_t head;
+        std::vector<int64_t> slots;
+
+        uint64_t primary_key() const { return 0; }
+    };
+    typedef eosio::multi_index<"penaltyring"_n, penalty_schedule> penalty_schedule_table;
+
     TABLE dmc_config {
         name key;
         uint64_t value;
@@ -644,6 +890,73 @@ public:
         indexed_by<"settlement"_n, const_mem_fun<dmc_order, uint64_t, &dmc_order::by_settlement_date>>>
         dmc_orders;
 
+    /**
+     * an order is stored as two rows, amounts are kept without their symbols: pst for miner_lock_pst,
+     * rsi for the *_rsi fields and dmc for the others. dmc_order is still what the code and orderrec work on,
+     * the legacy dmcorder row of an order is moved here on its first write or by ordermigrate.
+     */
+    // fields fixed when the order is made
+    TABLE order_cold {
+        uint64_t order_id;
+        name user;
+        name miner;
+        uint64_t bill_id;
+        int64_t miner_lock_pst;
+        int64_t price;
+        uint64_t epoch;
+
+        uint64_t primary_key() const { return order_id; }
+        uint64_t by_miner() const { return miner.value; }
+    };
+    typedef eosio::multi_index<"ordercold"_n, order_cold,
+        indexed_by<"miner"_n, const_mem_fun<order_cold, uint64_t, &order_cold::by_miner>>>
+        order_colds;
+
+    // fields changed by every settlement
+    TABLE order_hot {
+        uint64_t order_id;
+        OrderState state;
+        int64_t user_pledge;
+        int64_t miner_lock_dmc;
+        int64_t settlement_pledge;
+        int64_t lock_pledge;
+        int64_t deposit;
+        int64_t miner_lock_rsi;
+        int64_t miner_rsi;
+        int64_t user_rsi;
+        time_point_sec deliver_start_date;
+        time_point_sec latest_settlement_date;
+        time_point_sec deposit_valid;
+        time_point_sec cancel_date;
+
+        uint64_t primary_key() const { return order_id; }
+        uint128_t by_state_id() const { return dmc_order::get_state_id(state, order_id); }
+    };
+    typedef eosio::multi_index<"orderhot"_n, order_hot,
+        indexed_by<"stateid"_n, const_mem_fun<order_hot, uint128_t, &order_hot::by_state_id>>>
+        order_hots;
+
+    // when the next phishing draw is due, and the size of the candidate pool
+    TABLE phishing_state {
+        time_point_sec next_at;
+        uint64_t candidate_count;
+
+        uint64_t primary_key() const { return 0; }
+    };
+    typedef eosio::multi_index<"phishstate"_n, phishing_state> phishing_state_table;
+
+    // the orders a phishing draw picks from, `index` is dense in [0, candidate_count)
+    TABLE phishing_candidate {
+        uint64_t index;
+        uint64_t order_id;
+
+        uint64_t primary_key() const { return index; }
+        uint64_t by_order() const { return order_id; }
+    };
+    typedef eosio::multi_index<"phishcand"_n, phishing_candidate,
+        indexed_by<"byorder"_n, const_mem_fun<phishing_candidate, uint64_t, &phishing_candidate::by_order>>>
+        phishing_candidates;
+
     TABLE dmc_challenge {
         uint64_t order_id;
         checksum256 pre_merkle_root;
@@ -665,6 +978,11 @@ public:
     };
     typedef eosio::multi_index<"dmchallenge"_n, dmc_challenge> dmc_challenges;
 
+    /**
+     * total_staked / total_weight is the value of one unit of pool weight. Order rewards are
+     * added to total_staked without minting weight, so every LP accrues in O(1) and realizes
+     * its share when it next touches its position.
+     */
     TABLE dmc_maker {
         name miner;
         double current_rate; // r
@@ -687,6 +1005,69 @@ public:
         indexed_by<"bym"_n, const_mem_fun<dmc_maker, uint64_t, &dmc_maker::by_m>>>
         dmc_makers;
 
+    // RSI incentive accrued by the bills of a maker and not yet swapped, settled by getincentive, settleincent, unbill and the redemptions of the miner
+    TABLE maker_incentive {
+        name miner;
+        int64_t pending_rsi;
+
+        uint64_t primary_key() const { return miner.value; }
+    };
+    typedef eosio::multi_index<"makerincent"_n, maker_incentive> maker_incentives;
+
+    /**
+     * weight is bought and redeemed at (total_staked + locked) / total_weight, `locked` is the stake held by open orders,
+     * so an lp joining or leaving while an order runs neither takes nor loses the share of it returned later.
+     * The lp part of an order reward adds reward / total_weight to reward_per_weight and waits in `unsettled`,
+     * an lp is paid weight * (reward_per_weight - reward_debt) when it next touches its position.
+     * A maker restaked from nothing starts a new epoch, the weights of an older epoch are worth nothing.
+     *
+     * Weight added while orders are open is young, it earns nothing of the orders placed before it joined.
+     * Every such join starts a new `gen`, an order keeps the gen it was placed in, the young weight only
+     * shares in the rewards of orders of the current gen through young_per_weight. It matures once the
+     * `young_open` orders older than the gen are closed, a reward_mature row keeps the indexes of that moment.
+     */
+    TABLE maker_reward {
+        name miner;
+        int64_t locked = 0;
+        double reward_per_weight = 0;
+        int64_t unsettled = 0;
+        uint64_t epoch = 0;
+        double closed_per_weight = 0; // reward_per_weight when the last epoch ended
+        uint64_t gen = 0;
+        uint64_t open_orders = 0;
+        uint64_t young_open = 0;
+        uint64_t young_lps = 0; // the young weight is waiting while it is not 0
+        double young_weight = 0;
+        double young_per_weight = 0;
+
+        uint64_t primary_key() const { return miner.value; }
+    };
+    typedef eosio::multi_index<"makerreward"_n, maker_reward> maker_rewards;
+
+    // scope is the miner, an lp without a row joined before the index existed and owes nothing
+    TABLE lp_reward {
+        name owner;
+        double reward_debt;
+        uint64_t epoch;
+        double young = 0; // the part of the weight that has not matured
+        uint64_t young_gen = 0;
+        double young_debt = 0;
+
+        uint64_t primary_key() const { return owner.value; }
+    };
+    typedef eosio::multi_index<"lpreward"_n, lp_reward> lp_rewards;
+
+    // scope is the miner, one row for each young weight that matured, erased once its last lp settled it
+    TABLE reward_mature {
+        uint64_t gen; // the last gen of the young weight
+        double young_per_weight;
+        double reward_per_weight;
+        uint64_t lps;
+
+        uint64_t primary_key() const { return gen; }
+    };
+    typedef eosio::multi_index<"rewardmature"_n, reward_mature> reward_matures;
+
     TABLE maker_pool {
         name owner;
         double weight;
@@ -720,8 +1101,56 @@ public:
         double benchmark_price;
         uint64_t primary_key() const { return 0; }
     };
+    // legacy, the row is erased by the first price traced after the upgrade
     typedef eosio::multi_index<"bcprice"_n, bc_price> bc_price_table;
 
+    // the benchmark price alone, so reading it does not deserialize a price list
+    TABLE bench_price {
+        double benchmark_price;
+        uint64_t primary_key() const { return 0; }
+    };
+    typedef eosio::multi_index<"benchprice"_n, bench_price> bench_price_table;
+
+    /**
+     * the multiset of order prices inside the ${pricedist} window, one row per distinct price,
+     * benchmark price is the median of it
+     */
+    TABLE price_count {
+        uint64_t price;
+        uint64_t count;
+
+        uint64_t primary_key() const { return price; }
+    };
+    // scope self: the whole window, scope day: the prices of one day, evicted together
+    typedef eosio::multi_index<"pricecount"_n, price_count> price_counts;
+
+    /**
+     * lower median of the window is at `median_price`, `below` prices of the window are lower than it
+     */
+    TABLE price_median {
+        uint64_t total;
+        uint64_t median_price;
+        uint64_t below;
+        std::vector<uint64_t> days; // days in the window, in ascending order
+
+        uint64_t primary_key() const { return 0; }
+    };
+    typedef eosio::multi_index<"pricemedian"_n, price_median> price_median_table;
+
+    /**
+     * the miner whose bills did not fit in the budget of the last liquidation call,
+     * `leftover` PST is still to be taken from its bills
+     */
+    TABLE liq_state {
+        name miner;
+        extended_asset origin;
+        extended_asset leftover;
+        extended_asset penalty;
+
+        uint64_t primary_key() const { return 0; }
+    };
+    typedef eosio::multi_index<"liqstate"_n, liq_state> liq_state_table;
+
     struct maker_lp_pool {
         name owner;
         double ratio;
@@ -732,8 +1161,10 @@ public:
         name miner;
         uint64_t bill_id;
         uint64_t rate;
-        std::vector<maker_lp_pool> lps;
+        std::vector<maker_lp_pool> lps; // legacy, new snapshots leave it empty
+        binary_extension<uint64_t> gen; // the reward gen of the maker when the order was placed
         uint64_t primary_key() const { return order_id; }
+        EOSLIB_SERIALIZE(maker_snapshot, (order_id)(miner)(bill_id)(rate)(lps)(gen))
     };
     typedef eosio::multi_index<"makesnapshot"_n, maker_snapshot> maker_snapshot_table;
 
@@ -754,6 +1185,50 @@ public:
     ACTION dismakerec(uint64_t order_id, std::vector<asset_type_args> rewards, extended_asset total_sub, std::vector<distribute_maker_snapshot> distribute_info);
     ACTION assetrec(uint64_t order_id, std::vector<extended_asset> changed, name owner, AssetReceiptType rec_type);
     ACTION orderassrec(uint64_t order_id, std::vector<asset_type_args> changed, name owner, AccountType acc_type, time_point_sec exec_date);
+    // `periods` claims intervals of an order settled at once, `changed` is the total of them
+    ACTION catchuprec(uint64_t order_id, uint64_t periods, std::vector<asset_type_args> changed, name owner, AccountType acc_type, time_point_sec exec_date);
+    // the row of a swap market after it changed, a removed market has zero total_weights
+    ACTION marketrec(uniswap_market market_info);
+    // the balance `owner` holds after it changed
+    ACTION balancerec(name owner, extended_asset balance);
+    /**
+     * all records of one action in the order they happened, `version` is event_version,
+     * records[i] is number `first_seq + i` of the sequence kept in dmcconfig "eventseq"
+     */
+    ACTION events(uint16_t version, std::vector<event_record> records, binary_extension<uint64_t> first_seq);
+#ifdef DMC_TOKEN_PROFILE
+    // counters of the action that sent it, only in the DMC_TOKEN_PROFILE build
+    ACTION perfrec(std::vector<profile::perf_counters> scopes);
+#endif
+
+    template <typename T>
+    struct event_args;
+
+    template <typename... Args>
+    struct event_args<void (token::*)(Args...)> {
+        typedef std::tuple<std::decay_t<Args>...> type;
+    };
+
+    template <typename Action>
+    void emit_event(name type, typename event_args<Action>::type args)
+    {
+        _events.push_back({type, pack(args)});
+    }
+
+private:
+    std::vector<event_record> _events;
+
+    void flush_events();
+#ifdef DMC_TOKEN_PROFILE
+    void flush_profile();
+#endif
+
+    struct pst_vote {
+        name owner;
+        int64_t pst_amount;
+    };
+    // owners whose PST changed in this action, their totals are sent to the system once in the destructor
+    std::set<uint64_t> _dirty_voters;
 
 private:
     inline static name get_foundation(name issuer)
@@ -764,27 +1239,72 @@ private:
     void sub_balance(name owner, extended_asset value);
     void add_balance(name owner, extended_asset value, name ram_payer);
 
-    void lock_sub_balance(name owner, extended_asset value, time_point_sec lock_timestamp);
+    time_point_sec lock_sub_balance(name owner, extended_asset value, time_point_sec lock_timestamp);
     void lock_sub_balance(name foundation, extended_asset quantity, bool recur = false);
     void lock_add_balance(name owner, extended_asset value, time_point_sec lock_timestamp, name ram_payer);
+    void change_lock_summary(name owner, extended_asset value, name ram_payer);
     // convert balance to lock_balance
     void exchange_balance_to_lockbalance(name owner, extended_asset value, time_point_sec lock_timestamp, name ram_payer);
     extended_asset get_balance(extended_asset quantity, name name);
+    accounts_v2::const_iterator find_account(accounts_v2& acnts, name owner, const extended_symbol& symbol);
 
 private:
-    uint64_t calbonus(name owner, uint64_t primary, name ram_payer);
+    uint64_t calbonus(name owner, uint64_t primary);
+    void accrue_incentive(name owner, int64_t rsi_amount);
+    void settle_incentive(name owner, uint64_t bill_id);
+    void change_bill_level(uint64_t price, extended_asset unmatched, int64_t bill_count);
+    bool is_bill_book_ready();
+    template <typename From, typename To, typename Moved>
+    typename From::const_iterator move_bills(From& from, typename From::const_iterator iter, To& to, uint64_t limit, name payer, Moved&& moved);
+    void run_liquidation(bool resume_only);
+    bool liquidate_bills(liq_state& state, uint64_t& bill_budget);
+    void finish_liquidation(const liq_state& state);
+    // true while the miner's bills still owe PST to a pending liquidation, its PST can not move meanwhile
+    bool is_liquidating(name miner);
     double cal_current_rate(extended_asset dmc_asset, name owner, double real_m);
 
 private:
-    void generate_maker_snapshot(uint64_t order_id, uint64_t bill_id, name miner, name payer, uint64_t r, bool reset = false);
-    void update_order_asset(dmc_order& order, OrderState new_state, uint64_t claims_interval);
+    void generate_maker_snapshot(uint64_t order_id, uint64_t bill_id, name miner, name payer, uint64_t r, uint64_t gen);
+    void update_order_asset(dmc_order& order, OrderState new_state, uint64_t claims_interval, uint64_t periods = 1);
+    void catch_up_order(dmc_order& order, const dmc_challenge& challenge, time_point_sec current, uint64_t claims_interval);
     void change_order(dmc_order& order, const dmc_challenge& challenge, time_point_sec current, uint64_t claims_interval, name payer);
-    void update_order(dmc_order& order, const dmc_challenge& challenge, name payer);
-    extended_asset distribute_lp_pool(uint64_t order_id, std::vector<asset_type_args> rewards, extended_asset challenge_pledge, name payer);
+    void update_order(dmc_order& order, const dmc_challenge& challenge, name payer, bool phishing = true);
+    void claim_orders(name payer, std::vector<uint64_t> order_ids);
+    dmc_order get_order(uint64_t order_id);
+    void store_order(const dmc_order& order, name payer);
+    void erase_order(uint64_t order_id);
+    bool maker_has_orders(name miner);
+    // miner payouts are added to `credits` instead of the balance when it is given
+    extended_asset distribute_lp_pool(uint64_t order_id, std::vector<asset_type_args> rewards, extended_asset challenge_pledge, name payer, std::map<name, int64_t>* credits = nullptr);
     void phishing_challenge();
+    bool is_phishing_state(OrderState state);
+    maker_reward get_maker_reward(name miner);
+    void set_maker_reward(const maker_reward& reward);
+    double settle_lp_reward(maker_reward& reward, name owner, double weight, double change, name payer);
+    void mature_young_weight(maker_reward& reward);
+    void erase_lp_reward(name miner, name owner);
+    phishing_state get_phishing_state();
+    void save_phishing_state(const phishing_state& state);
+    void add_phishing_candidate(uint64_t order_id);
+    void remove_phishing_candidate(uint64_t order_id);
+
+private:
+    nft_symbol_info get_nft_symbol(const extended_symbol& nft_symbol);
+    int64_t change_nft_holding(name owner, uint64_t symbol_id, uint64_t nft_id, int64_t delta, name ram_payer);
+    std::vector<nft_batch_args> merge_nft_batch(std::vector<nft_batch_args> batch_args);
     void delete_maker_snapshot(uint64_t order_id);
     void delete_order_pst(const dmc_order& order);
     void send_totalvote_to_system(name owner);
+    void flush_totalvotes();
+
+private:
+    void add_window_price(price_median& median, uint64_t day, uint64_t price);
+    void evict_window_day(price_median& median);
+    uint64_t settle_price_median(price_median& median);
+
+private:
+    int64_t release_penalty_schedule(penalty_schedule& schedule, time_point_sec now_time);
+    int64_t fold_penalty_stats(penalty_schedule& schedule, time_point_sec now_time);
 };
 
 asset token::get_supply(symbol_code sym) const
@@ -797,12 +1317,27 @@ asset token::get_supply(symbol_code sym) const
 template <typename T, T (*wipe_function)(T)>
 extended_asset token::get_asset_by_amount(T amount, extended_symbol symbol)
 {
-    uint64_t asset_amount = wipe_function(amount * std::pow(10, symbol.get_symbol().precision()));
+    uint64_t asset_amount = wipe_function(amount * fixed::pow10(symbol.get_symbol().precision()));
     extended_asset asset = extended_asset(asset_amount, symbol);
     check(asset.quantity.is_valid(), "Invalid asset, please change symbol!");
     return asset;
 }
 
+// erases at most `limit` bills of `from` from `iter` on and stores them again in `to`, `payer` pays for the new rows, the owner of each bill when empty
+template <typename From, typename To, typename Moved>
+typename From::const_iterator token::move_bills(From& from, typename From::const_iterator iter, To& to, uint64_t limit, name payer, Moved&& moved)
+{
+    for (uint64_t count = 0; iter != from.end() && count < limit; count++) {
+        bill_record bill_info = *iter;
+        iter = from.erase(iter);
+        to.emplace(payer == name() ? bill_info.owner : payer, [&](auto& r) {
+            r = bill_info;
+        });
+        moved(bill_info);
+    }
+    return iter;
+}
+
 template <typename T>
 checksum256 sha256(const T& value)
 {
@@ -0,0 +1,94 @@
+/**
+ *  @file
+ *  @copyright defined in dmc/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/check.hpp>
+#include <stdint.h>
+
+namespace eosio {
+namespace fixed {
+
+    typedef unsigned __int128 uint128;
+
+    constexpr uint64_t pow10_table[] = {
+        1ull,
+        10ull,
+        100ull,
+        1000ull,
+        10000ull,
+        100000ull,
+        1000000ull,
+        10000000ull,
+        100000000ull,
+        1000000000ull,
+        10000000000ull,
+        100000000000ull,
+        1000000000000ull,
+        10000000000000ull,
+        100000000000000ull,
+        1000000000000000ull,
+        10000000000000000ull,
+        100000000000000000ull,
+        1000000000000000000ull,
+    };
+    constexpr uint8_t max_precision = sizeof(pow10_table) / sizeof(pow10_table[0]) - 1;
+
+    inline uint64_t pow10(uint8_t precision) {
+        check(precision <= max_precision, "precision is too large");
+        return pow10_table[precision];
+    }
+
+    // floor(sqrt(n))
+    inline uint64_t isqrt(uint128 n) {
+        if (n < 2)
+            return (uint64_t)n;
+        uint128 x = n;
+        uint128 y = x / 2 + 1;
+        // Newton's method from above converges on the floor
+        while (y < x) {
+            x = y;
+            y = (x + n / x) / 2;
+        }
+        return (uint64_t)x;
+    }
+
+    inline uint64_t narrow(uint128 value) {
+        check(value <= UINT64_MAX, "fixed point overflow");
+        return (uint64_t)value;
+    }
+
+    // a * b / c rounded to nearest, halves up
+    inline uint64_t mul_div_round(uint64_t a, uint64_t b, uint64_t c) {
+        check(c > 0, "divide by zero");
+        return narrow(((uint128)a * b + c / 2) / c);
+    }
+
+    inline uint64_t mul_div_ceil(uint64_t a, uint64_t b, uint64_t c) {
+        check(c > 0, "divide by zero");
+        return narrow(((uint128)a * b + c - 1) / c);
+    }
+
+    /**
+     * price of x in y as a 32.32 fixed point number, from raw amounts and their precisions,
+     * saturates to UINT64_MAX
+     */
+    inline uint64_t price_x32(uint64_t x, uint8_t x_precision, uint64_t y, uint8_t y_precision) {
+        check(y > 0, "divide by zero");
+        uint128 num = (uint128)x << 32;
+        uint128 den = y;
+        if (y_precision >= x_precision) {
+            uint64_t scale = pow10(y_precision - x_precision);
+            if (num > ((uint128)-1) / scale)
+                return UINT64_MAX;
+            num *= scale;
+        } else {
+            den *= pow10(x_precision - y_precision);
+        }
+        uint128 price = num / den;
+        return price > UINT64_MAX ? UINT64_MAX : (uint64_t)price;
+    }
+
+} // namespace fixed
+} // namespace eosio
@@ -0,0 +1,59 @@
+/**
+ *  @file
+ *  @copyright defined in dmc/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/check.hpp>
+#include <eosio/crypto.hpp>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace eosio {
+namespace merkle {
+
+    /**
+     * a proof packed as a direction bitmap and the sibling of every level, bit i of `directions`
+     * is set when the node at level i is the right child. For a leaf, `directions` is its index.
+     * A challenge names a single data block, so there is no proof of several leaves here.
+     */
+    struct proof {
+        uint64_t directions;
+        std::vector<checksum256> siblings;
+    };
+
+    // sha256(left || right) through a 64 bytes stack buffer
+    inline checksum256 hash_pair(const checksum256& left, const checksum256& right) {
+        char buf[64];
+        auto left_bytes = left.extract_as_byte_array();
+        auto right_bytes = right.extract_as_byte_array();
+        memcpy(buf, left_bytes.data(), 32);
+        memcpy(buf + 32, right_bytes.data(), 32);
+        return sha256(buf, sizeof(buf));
+    }
+
+    // sha256(data || nonce), the intrinsic takes one contiguous buffer so it is filled once with its final size
+    inline checksum256 hash_with_nonce(const std::vector<char>& data, const std::string& nonce) {
+        std::vector<char> buf;
+        buf.reserve(data.size() + nonce.size());
+        buf.insert(buf.end(), data.begin(), data.end());
+        buf.insert(buf.end(), nonce.begin(), nonce.end());
+        return sha256(buf.data(), buf.size());
+    }
+
+    inline checksum256 compute_root(checksum256 node, const proof& p) {
+        uint64_t directions = p.directions;
+        for (const auto& sibling : p.siblings) {
+            node = directions & 1 ? hash_pair(sibling, node) : hash_pair(node, sibling);
+            directions >>= 1;
+        }
+        return node;
+    }
+
+    inline bool verify(const checksum256& leaf_hash, const proof& p, const checksum256& root) {
+        return compute_root(leaf_hash, p) == root;
+    }
+
+} // namespace merkle
+} // namespace eosio
@@ -0,0 +1,94 @@
+/**
+ *  @file
+ *  @copyright defined in dmc/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/name.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <stdint.h>
+#include <vector>
+
+namespace eosio {
+namespace profile {
+
+    // ScopeAction is open for the whole action, the others around the function they are named after
+    enum scope_id : uint8_t {
+        ScopeAction = 0,
+        ScopePriceHistory,
+        ScopeUpdateOrder,
+        ScopeDistributeLpPool,
+        ScopeDmcByVrsi,
+        ScopeEnd,
+    };
+
+    /**
+     * the counters of one scope in perfrec, a nested scope is charged to every scope around it.
+     * The chain gives a contract no cpu clock, time is left to the benchmarks.
+     */
+    struct perf_counters {
+        name scope;
+        uint64_t calls;
+        uint64_t db_reads;
+        uint64_t db_writes;
+        uint64_t iterations;
+        uint64_t inlines;
+    };
+
+#ifdef DMC_TOKEN_PROFILE
+    // every action runs in a fresh instance, so these start from zero
+    inline perf_counters scope_counters[ScopeEnd] = {
+        {"action"_n}, {"pricehistory"_n}, {"updateorder"_n}, {"distlppool"_n}, {"dmcbyvrsi"_n}};
+    inline uint32_t active_scopes = 1u << ScopeAction;
+
+    inline void count(uint64_t perf_counters::*field, uint64_t n = 1) {
+        for (uint8_t id = 0; id < ScopeEnd; id++) {
+            if (active_scopes & (1u << id))
+                scope_counters[id].*field += n;
+        }
+    }
+
+    class scope {
+    public:
+        explicit scope(scope_id id) : saved(active_scopes) {
+            active_scopes |= 1u << id;
+            scope_counters[id].calls++;
+        }
+        ~scope() { active_scopes = saved; }
+
+    private:
+        uint32_t saved;
+    };
+
+    // record actions only check their auth, reporting them would send a perfrec for every perfrec
+    inline bool idle() {
+        const auto& c = scope_counters[ScopeAction];
+        return c.db_reads == 0 && c.db_writes == 0 && c.iterations == 0 && c.inlines == 0;
+    }
+
+    inline std::vector<perf_counters> summary() {
+        scope_counters[ScopeAction].calls = 1;
+        std::vector<perf_counters> result;
+        for (const auto& c : scope_counters) {
+            if (c.calls > 0)
+                result.push_back(c);
+        }
+        return result;
+    }
+#endif
+
+} // namespace profile
+} // namespace eosio
+
+/**
+ * DMC_PROFILE_SCOPE(ScopeUpdateOrder) charges the rest of the block to a scope,
+ * DMC_PROFILE_COUNT(db_reads) or DMC_PROFILE_COUNT(iterations, n) adds to a counter, both compile to nothing by default.
+ * A count sits right before the lookup, emplace, modify or erase it stands for, so every path counts what it runs
+ */
+#ifdef DMC_TOKEN_PROFILE
+#define DMC_PROFILE_SCOPE(ID) ::eosio::profile::scope BOOST_PP_CAT(dmc_profile_scope_, __LINE__)(::eosio::profile::ID)
+#define DMC_PROFILE_COUNT(FIELD, ...) ::eosio::profile::count(&::eosio::profile::perf_counters::FIELD, ##__VA_ARGS__)
+#else
+#define DMC_PROFILE_SCOPE(ID)
+#define DMC_PROFILE_COUNT(FIELD, ...)
+#endif
@@ -15,6 +15,7 @@ void token::bill(name owner, extended_asset asset, double price, time_point_sec
     check(price >= 0.0001 && (price < (uint64_t(1) << 50)), "invalid price");
     check(asset.quantity.amount > 0, "must bill a positive amount");
     check(deposit_ratio >= 0 && deposit_ratio <= 99, "invalid deposit ratio");
+    check(is_bill_book_ready(), "bill book migration in progress");
 
     time_point_sec now_time = time_point_sec(current_time_point());
     check(expire_on >= now_time + get_dmc_config("serverinter"_n, default_service_interval), "invalid service time");
@@ -22,7 +23,7 @@ void token::bill(name owner, extended_asset asset, double price, time_point_sec
     uint64_t price_t = std::round(price * 10000);
 
     sub_balance(owner, asset);
-    bill_stats sst(get_self(), get_self().value);
+    bill_table sst(get_self(), get_self().value);
 
     uint64_t bill_id = get_dmc_config("billid"_n, default_id_start);
     bill_record bill_info = {
@@ -40,44 +41,33 @@ void token::bill(name owner, extended_asset asset, double price, time_point_sec
     sst.emplace(owner, [&](auto& r) {
         r = bill_info;
     });
-    SEND_INLINE_ACTION(*this, billsnap, {_self, "active"_n}, {bill_info});
+    change_bill_level(price_t, asset, 1);
+    EMIT_EVENT(*this, billsnap, {bill_info});
 }
 
 void token::unbill(name owner, uint64_t bill_id, string memo) {
     require_auth(owner);
     check(memo.size() <= 256, "memo has more than 256 bytes");
 
-    // TODO: delete it after
-    if (bill_id < get_dmc_config("olderbillid"_n, default_id_start)) {
-        bill_stats sst(get_self(), owner.value);
-        auto ust = sst.find(bill_id);
-        check(ust != sst.end(), "no such record");
-        extended_asset unmatched_asseet = ust->unmatched;
-        calbonus(owner, bill_id, owner);
-        sst.erase(ust);
-        add_balance(owner, unmatched_asseet, owner);
-        bill_record bill_info = {
-            .bill_id = bill_id,
-            .owner = owner,
-            .unmatched = unmatched_asseet};
-
-        SEND_INLINE_ACTION(*this, billsnap, {_self, "active"_n}, {bill_info});
-    } else {
-        bill_stats sst(get_self(), get_self().value);
-        auto ust = sst.find(bill_id);
-        check(ust != sst.end(), "no such record");
-        check(ust->owner == owner, "only owner can unbill");
-        extended_asset unmatched_asseet = ust->unmatched;
-        calbonus(owner, bill_id, owner);
-        sst.erase(ust);
-        add_balance(owner, unmatched_asseet, owner);
-        bill_record bill_info = {
-            .bill_id = bill_id,
-            .owner = owner,
-            .unmatched = unmatched_asseet};
+    check(is_bill_book_ready(), "bill book migration in progress");
+    bill_table sst(get_self(), get_self().value);
+    auto ust = sst.find(bill_id);
+    check(ust != sst.end(), "no such record");
+    check(ust->owner == owner, "only owner can unbill");
+    check(!is_liquidating(owner), "bills are being liquidated");
+    extended_asset unmatched_asseet = ust->unmatched;
+    calbonus(owner, bill_id);
+    // the incentive is swapped while the owner still has a bill to claim it with
+    settle_incentive(owner, bill_id);
+    change_bill_level(ust->price, -unmatched_asseet, -1);
+    sst.erase(ust);
+    add_balance(owner, unmatched_asseet, owner);
+    bill_record bill_info = {
+        .bill_id = bill_id,
+        .owner = owner,
+        .unmatched = unmatched_asseet};
 
-        SEND_INLINE_ACTION(*this, billsnap, {_self, "active"_n}, {bill_info});
-    }
+    EMIT_EVENT(*this, billsnap, {bill_info});
 }
 
 void token::order(name owner, uint64_t bill_id, uint64_t benchmark_price, PriceRangeType price_range, uint64_t epoch, extended_asset asset, extended_asset reserve, string memo) {
@@ -111,64 +101,65 @@ void token::order(name owner, uint64_t bill_id, uint64_t benchmark_price, PriceR
     uint64_t lower_bound_begin = benchmark_price * (100 - range) / 100;
     uint64_t upper_bound_end = range == 100 ? uint64_max : benchmark_price * (100 + range) / 100;
 
-    bill_stats sst(get_self(), get_self().value);
-    auto price_idx = sst.get_index<"bylowerprice"_n>();
-    auto lower_bound_iter = price_idx.lower_bound(lower_bound_begin);
-    bool is_match = false;
+    check(is_bill_book_ready(), "bill book migration in progress");
+    bill_table sst(get_self(), get_self().value);
+    auto bill_iter = sst.find(bill_id);
+    check(bill_iter != sst.end() && bill_iter->unmatched >= asset, "no matched bill");
+    check(bill_iter->price >= lower_bound_begin && bill_iter->price <= upper_bound_end, "no matched bill");
     uint64_t bill_number_limit = get_dmc_config("billnumlimit"_n, default_bill_num_limit);
 
-    // search ${bill_number_limit} records,
-    // NOTE: the actual situation may be more than ${bill_number_limit} entries, as entries with the same price count as one.
-    auto start_price = lower_bound_iter->price;
-    for (uint64_t count = 0; lower_bound_iter != price_idx.end() && count < bill_number_limit; lower_bound_iter++) {
-        if (lower_bound_iter->unmatched < asset) {
+    // the bill can only be ordered within the first ${bill_number_limit} price levels able to serve this order,
+    // a level is skipped by its aggregate unmatched, or by one capacity lookup, without reading each of its bills.
+    bill_levels level_tbl(get_self(), get_self().value);
+    auto capacity_idx = sst.get_index<"bypricecap"_n>();
+    uint64_t skipped_levels = 0;
+    for (auto level_iter = level_tbl.lower_bound(lower_bound_begin); level_iter != level_tbl.end() && level_iter->price < bill_iter->price; level_iter++) {
+        if (level_iter->unmatched < asset) {
             continue;
         }
-        if (lower_bound_iter->price > upper_bound_end) {
-            break;
-        }
-        // only count the first record with the same price
-        if (lower_bound_iter->price != start_price) {
-            count++;
-            start_price = lower_bound_iter->price;
+        auto capacity_iter = capacity_idx.lower_bound(bill_record::get_price_capacity(level_iter->price, asset.quantity.amount));
+        if (capacity_iter == capacity_idx.end() || capacity_iter->price != level_iter->price) {
+            continue;
         }
-        if (lower_bound_iter->bill_id == bill_id) {
-            is_match = true;
+        if (++skipped_levels > bill_number_limit) {
             break;
         }
     }
-    check(is_match, "no matched bill");
+    check(skipped_levels <= bill_number_limit, "no matched bill");
 
-    name miner = lower_bound_iter->owner;
+    name miner = bill_iter->owner;
     check(miner != owner, "can not order with self");
+    check(!is_liquidating(miner), "bills are being liquidated");
     require_recipient(miner);
     require_recipient(owner);
 
     uint64_t order_serivce_epoch = get_dmc_config("ordsrvepoch"_n, default_order_service_epoch);
     uint64_t claims_interval = get_dmc_config("claiminter"_n, default_dmc_claims_interval);
 
-    check(time_point_sec(current_time_point() + eosio::seconds(claims_interval * epoch)) <= lower_bound_iter->expire_on, "service has expired");
+    check(time_point_sec(current_time_point() + eosio::seconds(claims_interval * epoch)) <= bill_iter->expire_on, "service has expired");
     check((claims_interval * epoch) >= order_serivce_epoch, "service not reach minimum deposit expire time");
 
-    double price = (double)lower_bound_iter->price / 10000;
+    double price = (double)bill_iter->price / 10000;
     double dmc_amount = price * asset.quantity.amount;
     extended_asset user_to_pay = get_asset_by_amount<double, std::round>(dmc_amount, dmc_sym);
 
     // deposit
-    extended_asset user_to_deposit = extended_asset(std::floor(user_to_pay.quantity.amount * lower_bound_iter->deposit_ratio), dmc_sym);
+    extended_asset user_to_deposit = extended_asset(std::floor(user_to_pay.quantity.amount * bill_iter->deposit_ratio), dmc_sym);
     check(reserve >= user_to_pay + user_to_deposit, "reserve can't pay first time");
     sub_balance(owner, reserve);
 
-    uint64_t now_time_t = calbonus(miner, bill_id, owner);
+    uint64_t now_time_t = calbonus(miner, bill_id);
 
-    price_idx.modify(lower_bound_iter, get_self(), [&](auto& s) {
+    sst.modify(bill_iter, get_self(), [&](auto& s) {
         s.unmatched -= asset;
         s.matched += asset;
         s.updated_at = time_point_sec(now_time_t);
     });
-
-    if (lower_bound_iter->unmatched.quantity.amount == 0) {
-        price_idx.erase(lower_bound_iter);
+    // copied before the erase below, for tracker it keeps the orderings the table no longer indexes
+    bill_record bill_info = *bill_iter;
+    change_bill_level(bill_info.price, -asset, bill_info.unmatched.quantity.amount == 0 ? -1 : 0);
+    if (bill_info.unmatched.quantity.amount == 0) {
+        sst.erase(bill_iter);
     }
 
     uint64_t order_id = get_dmc_config("orderid"_n, default_id_start);
@@ -177,8 +168,7 @@ void token::order(name owner, uint64_t bill_id, uint64_t benchmark_price, PriceR
     auto maker_iter = maker_tbl.find(miner.value);
     check(maker_iter != maker_tbl.end(), "can't find maker pool");
 
-    dmc_orders order_tbl(get_self(), get_self().value);
-    uint64_t r = std::floor(maker_iter->current_rate * 100.0 / get_benchmark_price());
+    uint64_t r = std::floor(maker_iter->current_rate * 100.0 / current_price);
     // r = 5m' if r > 5m'
     if (r > maker_iter->benchmark_stake_rate * 5) {
         r = maker_iter->benchmark_stake_rate * 5;
@@ -207,9 +197,7 @@ void token::order(name owner, uint64_t bill_id, uint64_t benchmark_price, PriceR
         .deposit_valid = time_point_sec(),
         .cancel_date = time_point_sec(),
     };
-    order_tbl.emplace(owner, [&](auto& o) {
-        o = order_info;
-    });
+    store_order(order_info, owner);
 
     dmc_challenge challenge_info = {
         .order_id = order_id,
@@ -231,15 +219,20 @@ void token::order(name owner, uint64_t bill_id, uint64_t benchmark_price, PriceR
         m.current_rate = cal_current_rate(m.total_staked - miner_lock_dmc, miner, m.get_real_m());
         m.total_staked -= miner_lock_dmc;
     });
+    maker_reward reward = get_maker_reward(miner);
+    reward.locked += miner_lock_dmc.quantity.amount;
+    reward.open_orders++;
+    set_maker_reward(reward);
 
-    generate_maker_snapshot(order_info.order_id, bill_id, order_info.miner, owner, r, maker_iter->total_staked.quantity.amount == 0);
-    trace_price_history(price, bill_id, order_info.order_id);
+    generate_maker_snapshot(order_info.order_id, bill_id, order_info.miner, owner, r, reward.gen);
+    trace_price_history(bill_info.price);
     set_dmc_config("orderid"_n, order_id + 1);
-    SEND_INLINE_ACTION(*this, orderrec, {_self, "active"_n}, {order_info, 1});
-    SEND_INLINE_ACTION(*this, challengerec, {_self, "active"_n}, {challenge_info});
-    SEND_INLINE_ACTION(*this, billsnap, {_self, "active"_n}, {*lower_bound_iter});
-    SEND_INLINE_ACTION(*this, assetrec, {_self, "active"_n}, {order_info.order_id, {reserve}, order_info.user, AssetReceiptAddReserve});
-    SEND_INLINE_ACTION(*this, orderassrec, {_self, "active"_n}, {order_info.order_id, {{reserve, OrderReceiptAddReserve}, {-user_to_deposit, OrderReceiptDeposit}, {-user_to_pay, OrderReceiptRenew}}, order_info.user, ACC_TYPE_USER, time_point_sec(current_time_point())});
+    EMIT_EVENT(*this, makerecord, {*maker_iter});
+    EMIT_EVENT(*this, orderrec, {order_info, 1});
+    EMIT_EVENT(*this, challengerec, {challenge_info});
+    EMIT_EVENT(*this, billsnap, {bill_info});
+    EMIT_EVENT(*this, assetrec, {order_info.order_id, {reserve}, order_info.user, AssetReceiptAddReserve});
+    EMIT_EVENT(*this, orderassrec, {order_info.order_id, {{reserve, OrderReceiptAddReserve}, {-user_to_deposit, OrderReceiptDeposit}, {-user_to_pay, OrderReceiptRenew}}, order_info.user, ACC_TYPE_USER, time_point_sec(current_time_point())});
 }
 
 void token::increase(name owner, extended_asset asset, name miner) {
@@ -253,6 +246,13 @@ void token::increase(name owner, extended_asset asset, name miner) {
     auto iter = maker_tbl.find(miner.value);
     dmc_maker_pool dmc_pool(get_self(), miner.value);
     auto p_iter = dmc_pool.find(owner.value);
+    maker_reward reward = get_maker_reward(miner);
+    bool restake = iter != maker_tbl.end() && iter->total_staked.quantity.amount + reward.locked == 0;
+    double new_weight = 0;
+    if (iter != maker_tbl.end() && !restake)
+        new_weight = (double)asset.quantity.amount / (iter->total_staked.quantity.amount + reward.locked) * iter->total_weight;
+    // the rewards earned by the old weight are paid before it changes
+    double owner_weight = settle_lp_reward(reward, owner, p_iter == dmc_pool.end() ? 0 : p_iter->weight, new_weight, owner);
     uint64_t benchmark_stake_rate = get_dmc_config("bmrate"_n, default_benchmark_stake_rate);
     if (iter == maker_tbl.end()) {
         if (owner == miner) {
@@ -272,19 +272,31 @@ void token::increase(name owner, extended_asset asset, name miner) {
         } else {
             check(false, "no such record");
         }
-    } else if (iter->total_staked.quantity.amount == 0) {
+    } else if (restake) {
         check(owner == miner, "only miner can stake now");
+        // nothing is left behind the old weights, they stay in the pool of an old epoch
+        if (reward.young_lps > 0)
+            mature_young_weight(reward);
+        reward.closed_per_weight = reward.reward_per_weight;
+        reward.epoch++;
+        settle_lp_reward(reward, owner, 0, 0, owner);
         maker_tbl.modify(iter, owner, [&](auto& m) {
             m.current_rate = cal_current_rate(asset, miner, m.get_real_m());
             m.total_weight = static_weights;
             m.total_staked = asset;
         });
-        dmc_pool.modify(p_iter, owner, [&](auto& p) {
-            p.weight = static_weights;
-        });
+        if (p_iter == dmc_pool.end()) {
+            p_iter = dmc_pool.emplace(owner, [&](auto& p) {
+                p.owner = owner;
+                p.weight = static_weights;
+            });
+        } else {
+            dmc_pool.modify(p_iter, owner, [&](auto& p) {
+                p.weight = static_weights;
+            });
+        }
     } else {
         extended_asset new_total = iter->total_staked + asset;
-        double new_weight = (double)asset.quantity.amount / iter->total_staked.quantity.amount * iter->total_weight;
         double total_weight = iter->total_weight + new_weight;
         check(new_weight > 0, "invalid new weight");
         // check(new_weight / total_weight > 0.0001, "the quantity of increase is insufficient.");
@@ -298,7 +310,7 @@ void token::increase(name owner, extended_asset asset, name miner) {
 
         if (p_iter != dmc_pool.end()) {
             dmc_pool.modify(p_iter, owner, [&](auto& s) {
-                s.weight += new_weight;
+                s.weight = owner_weight + new_weight;
             });
         } else {
             p_iter = dmc_pool.emplace(owner, [&](auto& p) {
@@ -316,14 +328,19 @@ void token::increase(name owner, extended_asset asset, name miner) {
             check(p_iter->weight / (total_weight * (1 - iter->miner_rate)) >= 0.01, "the quantity of increase is insufficient.");
         }
     }
-    SEND_INLINE_ACTION(*this, makerecord, {_self, "active"_n}, {*iter});
-    SEND_INLINE_ACTION(*this, makerpoolrec, {_self, "active"_n}, {miner, {*p_iter}});
+    set_maker_reward(reward);
+    EMIT_EVENT(*this, makerecord, {*iter});
+    EMIT_EVENT(*this, makerpoolrec, {miner, {*p_iter}});
 }
 
 void token::redemption(name owner, double rate, name miner) {
     require_auth(owner);
 
     check(rate > 0 && rate <= 1, "invalid rate");
+    if (owner == miner) {
+        // the pending incentive is added to the stake before the maker can be erased
+        settle_incentive(owner, 0);
+    }
     dmc_makers maker_tbl(get_self(), get_self().value);
     auto iter = maker_tbl.find(miner.value);
     check(iter != maker_tbl.end(), "no such record");
@@ -332,9 +349,22 @@ void token::redemption(name owner, double rate, name miner) {
     auto p_iter = dmc_pool.find(owner.value);
     check(p_iter != dmc_pool.end(), "no such limit partnership");
 
+    maker_reward reward = get_maker_reward(miner);
+    if (settle_lp_reward(reward, owner, p_iter->weight, -p_iter->weight * rate, owner) == 0) {
+        // a weight of an old epoch is worth nothing, leaving only settles its rewards
+        dmc_pool.modify(p_iter, owner, [&](auto& s) {
+            s.weight = 0;
+        });
+        EMIT_EVENT(*this, makerpoolrec, {miner, {*p_iter}});
+        dmc_pool.erase(p_iter);
+        erase_lp_reward(miner, owner);
+        set_maker_reward(reward);
+        return;
+    }
+
     double owner_weight = p_iter->weight * rate;
     double rede_rate = owner_weight / iter->total_weight;
-    extended_asset rede_quantity = extended_asset(std::floor(iter->total_staked.quantity.amount * rede_rate), dmc_sym);
+    extended_asset rede_quantity = extended_asset(std::floor((iter->total_staked.quantity.amount + reward.locked) * rede_rate), dmc_sym);
 
     bool last_one = false;
     if (rate == 1) {
@@ -344,13 +374,19 @@ void token::redemption(name owner, double rate, name miner) {
         });
 
         dmc_pool.erase(p_iter);
+        erase_lp_reward(miner, owner);
         auto pool_begin = dmc_pool.begin();
         if (pool_begin == dmc_pool.end()) {
             rede_quantity = iter->total_staked;
         } else if (++pool_begin == dmc_pool.end()) {
-            last_one = true;
             pool_begin--;
-            owner_weight = pool_begin->weight;
+            lp_rewards lp_tbl(get_self(), miner.value);
+            auto lp_iter = lp_tbl.find(pool_begin->owner.value);
+            // the weight of the last lp is the whole pool only in the current epoch
+            if ((lp_iter == lp_tbl.end() ? 0 : lp_iter->epoch) == reward.epoch) {
+                last_one = true;
+                owner_weight = pool_begin->weight;
+            }
         }
     } else {
         dmc_pool.modify(p_iter, owner, [&](auto& s) {
@@ -358,6 +394,7 @@ void token::redemption(name owner, double rate, name miner) {
         });
         check(p_iter->weight > 0, "negative pool weight amount");
     }
+    check(rede_quantity <= iter->total_staked, "maker stake is locked in orders");
 
     double total_weight = iter->total_weight - owner_weight;
     extended_asset total_staked = iter->total_staked - rede_quantity;
@@ -379,19 +416,27 @@ void token::redemption(name owner, double rate, name miner) {
     }
     check(rede_quantity.quantity.amount > 0, "dust attack detected");
     exchange_balance_to_lockbalance(owner, rede_quantity, time_point_sec(current_time_point() + eosio::days(3)), owner);
-    SEND_INLINE_ACTION(*this, redeemrec, {get_self(), "active"_n}, {owner, miner, rede_quantity});
+    EMIT_EVENT(*this, redeemrec, {owner, miner, rede_quantity});
     if (total_staked.quantity.amount == 0) {
         // for tracker
         maker_tbl.modify(iter, get_self(), [&](auto& m) {
             m.total_weight = 0;
         });
 
-        dmc_orders order_tbl(get_self(), get_self().value);
-        auto order_idx = order_tbl.get_index<"miner"_n>();
-        auto order_iter = order_idx.find(miner.value);
-        check(order_iter == order_idx.end(), "maker has orders");
+        check(!maker_has_orders(miner), "maker has orders");
 
         maker_tbl.erase(iter);
+        // the rounding dust of the rewards goes with the last stake
+        if (reward.unsettled > 0) {
+            extended_asset dust = extended_asset(reward.unsettled, dmc_sym);
+            add_balance(owner, dust, owner);
+            EMIT_EVENT(*this, lprewardrec, {owner, miner, dust});
+        }
+        maker_rewards reward_tbl(get_self(), get_self().value);
+        auto reward_iter = reward_tbl.find(miner.value);
+        if (reward_iter != reward_tbl.end()) {
+            reward_tbl.erase(reward_iter);
+        }
     } else {
         maker_tbl.modify(iter, get_self(), [&](auto& m) {
             m.total_weight = total_weight;
@@ -402,14 +447,26 @@ void token::redemption(name owner, double rate, name miner) {
         });
         check(iter->total_staked.quantity.amount >= 0, "negative total_staked amount");
         check(iter->total_weight >= 0, "negative total weight amount");
+        set_maker_reward(reward);
     }
 
     if (rate != 1) {
         check(p_iter->weight / (iter->total_weight * (1 - iter->miner_rate)) >= 0.01, "The remaining weight is too low");
     }
 
-    SEND_INLINE_ACTION(*this, makerecord, {_self, "active"_n}, {*iter});
-    SEND_INLINE_ACTION(*this, makerpoolrec, {_self, "active"_n}, {miner, {*p_iter}});
+    EMIT_EVENT(*this, makerecord, {*iter});
+    EMIT_EVENT(*this, makerpoolrec, {miner, {*p_iter}});
+}
+
+void token::getlpreward(name owner, name miner) {
+    require_auth(owner);
+    dmc_maker_pool dmc_pool(get_self(), miner.value);
+    auto p_iter = dmc_pool.find(owner.value);
+    check(p_iter != dmc_pool.end(), "no such limit partnership");
+
+    maker_reward reward = get_maker_reward(miner);
+    settle_lp_reward(reward, owner, p_iter->weight, 0, owner);
+    set_maker_reward(reward);
 }
 
 void token::mint(name owner, extended_asset asset) {
@@ -440,7 +497,7 @@ void token::mint(name owner, extended_asset asset) {
         m.current_rate = r;
     });
 
-    SEND_INLINE_ACTION(*this, makerecord, {_self, "active"_n}, {iter});
+    EMIT_EVENT(*this, makerecord, {iter});
 }
 
 void token::setmakerrate(name owner, double rate) {
@@ -458,7 +515,7 @@ void token::setmakerrate(name owner, double rate) {
         s.miner_rate = rate;
     });
 
-    SEND_INLINE_ACTION(*this, makerecord, {_self, "active"_n}, {iter});
+    EMIT_EVENT(*this, makerecord, {iter});
 }
 
 void token::setmakerbstr(name owner, uint64_t self_benchmark_stake_rate) {
@@ -485,7 +542,7 @@ void token::setmakerbstr(name owner, uint64_t self_benchmark_stake_rate) {
         s.rate_updated_at = now;
     });
 
-    SEND_INLINE_ACTION(*this, makerecord, {_self, "active"_n}, {iter});
+    EMIT_EVENT(*this, makerecord, {iter});
 }
 
 double token::cal_current_rate(extended_asset dmc_asset, name owner, double real_m) {
@@ -501,192 +558,371 @@ double token::cal_current_rate(extended_asset dmc_asset, name owner, double real
 void token::liquidation(string memo) {
     require_auth(dmc_account);
     check(memo.size() <= 256, "memo has more than 256 bytes");
+    // bills without a level entry can not be touched yet
+    if (!is_bill_book_ready())
+        return;
+    run_liquidation(false);
+}
+
+void token::runliq(name keeper) {
+    require_auth(keeper);
+    check(is_bill_book_ready(), "bill book migration in progress");
+    liq_state_table state_tbl(get_self(), get_self().value);
+    check(state_tbl.begin() != state_tbl.end(), "no pending liquidation");
+    run_liquidation(true);
+}
+
+void token::run_liquidation(bool resume_only) {
+    uint64_t maker_budget = get_dmc_config("liqmakers"_n, default_liquidation_maker_limit);
+    uint64_t bill_budget = get_dmc_config("liqbills"_n, default_liquidation_bill_limit);
+
+    liq_state_table state_tbl(get_self(), get_self().value);
+    auto state_iter = state_tbl.begin();
+    if (state_iter != state_tbl.end()) {
+        liq_state state = *state_iter;
+        if (!liquidate_bills(state, bill_budget)) {
+            state_tbl.modify(state_iter, get_self(), [&](auto& s) {
+                s = state;
+            });
+            return;
+        }
+        state_tbl.erase(state_iter);
+        finish_liquidation(state);
+        maker_budget = maker_budget > 0 ? maker_budget - 1 : 0;
+    }
+    if (resume_only)
+        return;
+
     dmc_makers maker_tbl(get_self(), get_self().value);
     auto maker_idx = maker_tbl.get_index<"byrate"_n>();
+    // the scan goes on from the maker the last call did not reach, makers that stay under the rate
+    // at the head of byrate would otherwise take the whole budget of every call
+    auto maker_it = maker_idx.cbegin();
+    uint64_t cursor = get_dmc_config("liqcursor"_n, 0);
+    auto cursor_iter = maker_tbl.find(cursor);
+    if (cursor_iter != maker_tbl.end()) {
+        maker_it = maker_idx.iterator_to(*cursor_iter);
+    }
 
     pststats pst_acnts(get_self(), get_self().value);
-    constexpr uint64_t required_size = 20;
-    std::vector<std::tuple<name /* miner */, extended_asset /* pst_asset */, extended_asset /* dmc_asset */>> liquidation_required;
-    liquidation_required.reserve(required_size);
+    // rates are changed after the scan, changing them inside it would reorder byrate
+    std::vector<liq_state> liquidation_required;
+    liquidation_required.reserve(maker_budget);
 
-    for (auto maker_it = maker_idx.cbegin(); maker_it != maker_idx.cend() && maker_it->current_rate < get_dmc_rate(maker_it->get_n()) && liquidation_required.size() < required_size; maker_it++) {
+    for (; maker_it != maker_idx.cend() && maker_it->current_rate < get_dmc_rate(maker_it->get_n()) && maker_budget > 0 && bill_budget > 0; maker_it++) {
+        maker_budget--;
         name owner = maker_it->miner;
         double r1 = maker_it->current_rate;
         auto pst_it = pst_acnts.find(owner.value);
 
         double m = get_dmc_rate(maker_it->benchmark_stake_rate);
         double sub_pst = (double)(1 - r1 / m) * get_real_asset(pst_it->amount);
-        extended_asset liq_pst_asset_leftover = get_asset_by_amount<double, std::ceil>(sub_pst, pst_sym);
-        auto origin_liq_pst_asset = liq_pst_asset_leftover;
+        double penalty_dmc = (double)(1 - r1 / m) * get_real_asset(maker_it->total_staked) * get_dmc_config("penaltyrate"_n, default_penalty_rate) / 100.0;
+        extended_asset origin = get_asset_by_amount<double, std::ceil>(sub_pst, pst_sym);
+        liq_state state{owner, origin, origin, get_asset_by_amount<double, std::ceil>(penalty_dmc, dmc_sym)};
 
-        accounts acnts(get_self(), owner.value);
-        auto account_idx = acnts.get_index<"byextendedas"_n>();
-        auto account_it = account_idx.find(account::key(pst_sym));
-        if (account_it != account_idx.end() && account_it->balance.quantity.amount > 0) {
-            extended_asset pst_sub = extended_asset(std::min(liq_pst_asset_leftover.quantity.amount, account_it->balance.quantity.amount), pst_sym);
+        extended_asset pst_balance = get_balance(extended_asset(0, pst_sym), owner);
+        if (pst_balance.quantity.amount > 0) {
+            extended_asset pst_sub = extended_asset(std::min(state.leftover.quantity.amount, pst_balance.quantity.amount), pst_sym);
 
             sub_balance(owner, pst_sub);
-            SEND_INLINE_ACTION(*this, currliqrec, {_self, "active"_n}, {owner, pst_sub});
-            liq_pst_asset_leftover.quantity.amount = std::max((liq_pst_asset_leftover - pst_sub).quantity.amount, 0ll);
+            EMIT_EVENT(*this, currliqrec, {owner, pst_sub});
+            state.leftover.quantity.amount = std::max((state.leftover - pst_sub).quantity.amount, 0ll);
         }
 
-        bill_stats sst(get_self(), get_self().value);
-        auto bill_idx = sst.get_index<"byowner"_n>();
-        auto bill_it = bill_idx.lower_bound(owner.value);
-
-        for (; bill_it != bill_idx.end() && liq_pst_asset_leftover.quantity.amount > 0 && bill_it->owner == owner;) {
-            extended_asset sub_pst;
-            if (bill_it->unmatched <= liq_pst_asset_leftover) {
-                sub_pst = bill_it->unmatched;
-                liq_pst_asset_leftover -= bill_it->unmatched;
-            } else {
-                sub_pst = liq_pst_asset_leftover;
-                liq_pst_asset_leftover.quantity.amount = 0;
-            }
+        if (!liquidate_bills(state, bill_budget)) {
+            state_tbl.emplace(get_self(), [&](auto& s) {
+                s = state;
+            });
+            maker_it++;
+            break;
+        }
+        liquidation_required.emplace_back(state);
+    }
+    // the next call starts from the head again once the rest of the makers are above the rate
+    bool scan_done = maker_it == maker_idx.cend() || maker_it->current_rate >= get_dmc_rate(maker_it->get_n());
+    uint64_t next_cursor = scan_done ? 0 : maker_it->miner.value;
+    if (next_cursor != cursor)
+        set_dmc_config("liqcursor"_n, next_cursor);
+
+    for (const auto& state : liquidation_required) {
+        finish_liquidation(state);
+    }
+}
 
-            uint64_t bill_id = bill_it->bill_id;
-            uint64_t now_time_t = calbonus(owner, bill_id, _self);
+// returns false when the budget ran out before the miner's bills cover the leftover
+bool token::liquidate_bills(liq_state& state, uint64_t& bill_budget) {
+    name owner = state.miner;
+    bill_table sst(get_self(), get_self().value);
+    auto bill_idx = sst.get_index<"byowner"_n>();
+    auto bill_it = bill_idx.lower_bound(owner.value);
+
+    for (; bill_it != bill_idx.end() && state.leftover.quantity.amount > 0 && bill_it->owner == owner;) {
+        if (bill_budget == 0)
+            return false;
+        bill_budget--;
+
+        extended_asset sub_pst;
+        if (bill_it->unmatched <= state.leftover) {
+            sub_pst = bill_it->unmatched;
+            state.leftover -= bill_it->unmatched;
+        } else {
+            sub_pst = state.leftover;
+            state.leftover.quantity.amount = 0;
+        }
 
-            bill_idx.modify(bill_it, get_self(), [&](auto& r) {
-                r.unmatched -= sub_pst;
-                r.updated_at = time_point_sec(now_time_t);
-                // for tracker
-                if (r.unmatched.quantity.amount == 0)
-                    r.price = 0;
-            });
+        uint64_t bill_id = bill_it->bill_id;
+        uint64_t now_time_t = calbonus(owner, bill_id);
+        change_bill_level(bill_it->price, -sub_pst, bill_it->unmatched == sub_pst ? -1 : 0);
 
-            SEND_INLINE_ACTION(*this, billsnap, {_self, "active"_n}, {*bill_it});
-            if (bill_it->unmatched.quantity.amount == 0)
-                bill_it = bill_idx.erase(bill_it);
-            else
-                bill_it++;
+        bill_idx.modify(bill_it, get_self(), [&](auto& r) {
+            r.unmatched -= sub_pst;
+            r.updated_at = time_point_sec(now_time_t);
+            // for tracker
+            if (r.unmatched.quantity.amount == 0)
+                r.price = 0;
+        });
 
-            SEND_INLINE_ACTION(*this, billliqrec, {_self, "active"_n}, {owner, bill_id, sub_pst});
-        }
-        extended_asset sub_pst_asset = origin_liq_pst_asset - liq_pst_asset_leftover;
-        double penalty_dmc = (double)(1 - r1 / m) * get_real_asset(maker_it->total_staked) * get_dmc_config("penaltyrate"_n, default_penalty_rate) / 100.0;
-        extended_asset penalty_dmc_asset = get_asset_by_amount<double, std::ceil>(penalty_dmc, dmc_sym);
-        if (sub_pst_asset.quantity.amount != 0 && penalty_dmc_asset.quantity.amount != 0) {
-            liquidation_required.emplace_back(std::make_tuple(owner, sub_pst_asset, penalty_dmc_asset));
+        EMIT_EVENT(*this, billsnap, {*bill_it});
+        if (bill_it->unmatched.quantity.amount == 0)
+            bill_it = bill_idx.erase(bill_it);
+        else
+            bill_it++;
+
+        EMIT_EVENT(*this, billliqrec, {owner, bill_id, sub_pst});
+    }
+    return true;
+}
+
+void token::finish_liquidation(const liq_state& state) {
+    extended_asset pst = state.origin - state.leftover;
+    if (pst.quantity.amount == 0 || state.penalty.quantity.amount == 0)
+        return;
+
+    name miner = state.miner;
+    dmc_makers maker_tbl(get_self(), get_self().value);
+    auto iter = maker_tbl.find(miner.value);
+    if (iter == maker_tbl.end())
+        return;
+
+    // the penalty was computed at scan time, the stake can be lower by now
+    extended_asset dmc = std::min(state.penalty, iter->total_staked);
+
+    change_pst(miner, -pst);
+    extended_asset new_staked = iter->total_staked - dmc;
+    double new_rate = cal_current_rate(new_staked, miner, iter->get_real_m());
+    maker_tbl.modify(iter, get_self(), [&](auto& s) {
+        s.total_staked = new_staked;
+        s.current_rate = new_rate;
+    });
+    add_balance(system_account, dmc, dmc_account);
+    EMIT_EVENT(*this, makerecord, {*iter});
+    EMIT_EVENT(*this, liqrec, {miner, pst, dmc});
+}
+
+bool token::is_liquidating(name miner) {
+    liq_state_table state_tbl(get_self(), get_self().value);
+    auto state_iter = state_tbl.begin();
+    return state_iter != state_tbl.end() && state_iter->miner == miner;
+}
+
+void token::bookmigrate(uint64_t limit) {
+    require_auth(config_account);
+    check(limit > 0, "invalid limit");
+    check(get_dmc_config("bookready"_n, 0) == 0, "bill book already migrated");
+
+    bill_stats sst(get_self(), get_self().value);
+    // a row stored before the capacity index existed has no entry in it, emplace it again to create one,
+    // the owners did not sign this so the contract pays for the new index entries
+    auto bill_iter = move_bills(sst, sst.lower_bound(get_dmc_config("bookcursor"_n, 0)), sst, limit, get_self(), [&](const bill_record& bill_info) {
+        change_bill_level(bill_info.price, bill_info.unmatched, 1);
+    });
+
+    if (bill_iter == sst.end()) {
+        set_dmc_config("bookready"_n, 1);
+    } else {
+        set_dmc_config("bookcursor"_n, bill_iter->bill_id);
+    }
+}
+
+void token::ordermigrate(uint64_t limit) {
+    require_auth(config_account);
+    check(limit > 0, "invalid limit");
+    dmc_orders legacy_tbl(get_self(), get_self().value);
+    check(legacy_tbl.begin() != legacy_tbl.end(), "orders already migrated");
+
+    for (uint64_t count = 0; count < limit; count++) {
+        // store_order erases the legacy row, so the next one is always the first
+        dmc_orders order_tbl(get_self(), get_self().value);
+        auto order_iter = order_tbl.begin();
+        if (order_iter == order_tbl.end()) {
+            break;
         }
+        dmc_order order_info = *order_iter;
+        store_order(order_info, get_self());
     }
+}
 
-    for (const auto liq : liquidation_required) {
-        name miner;
-        extended_asset pst;
-        extended_asset dmc;
-        std::tie(miner, pst, dmc) = liq;
-        auto pst_it = pst_acnts.find(miner.value);
-        change_pst(miner, -pst);
-        auto iter = maker_tbl.find(miner.value);
-        extended_asset new_staked = iter->total_staked - dmc;
-        double new_rate = cal_current_rate(new_staked, miner, iter->get_real_m());
-        maker_tbl.modify(iter, get_self(), [&](auto& s) {
-            s.total_staked = new_staked;
-            s.current_rate = new_rate;
+void token::change_bill_level(uint64_t price, extended_asset unmatched, int64_t bill_count) {
+    bill_levels level_tbl(get_self(), get_self().value);
+    auto level_iter = level_tbl.find(price);
+    if (level_iter == level_tbl.end()) {
+        check(bill_count > 0, "no such price level");  // never happened
+        level_tbl.emplace(get_self(), [&](auto& l) {
+            l.price = price;
+            l.unmatched = unmatched;
+            l.bill_count = bill_count;
         });
-        add_balance(system_account, dmc, dmc_account);
-        SEND_INLINE_ACTION(*this, makerecord, {_self, "active"_n}, {*iter});
-        SEND_INLINE_ACTION(*this, liqrec, {_self, "active"_n}, {miner, pst, dmc});
+        return;
     }
+
+    check(bill_count >= 0 || level_iter->bill_count >= uint64_t(-bill_count), "negative bill count of price level");  // never happened
+    if (level_iter->bill_count + bill_count == 0) {
+        level_tbl.erase(level_iter);
+        return;
+    }
+    level_tbl.modify(level_iter, get_self(), [&](auto& l) {
+        l.unmatched += unmatched;
+        l.bill_count += bill_count;
+    });
+    check(level_iter->unmatched.quantity.amount >= 0, "negative unmatched of price level");  // never happened
+}
+
+void token::billmigrate(uint64_t limit) {
+    require_auth(config_account);
+    check(limit > 0, "invalid limit");
+    check(get_dmc_config("bookready"_n, 0) != 0, "bill book migration in progress");
+    check(get_dmc_config("billready"_n, 0) == 0, "bills already migrated");
+
+    bill_stats legacy_tbl(get_self(), get_self().value);
+    bill_table sst(get_self(), get_self().value);
+    auto bill_iter = move_bills(legacy_tbl, legacy_tbl.begin(), sst, limit, name(), [&](const bill_record& bill_info) {
+        EMIT_EVENT(*this, billsnap, {bill_info});
+    });
+
+    if (bill_iter == legacy_tbl.end()) {
+        set_dmc_config("billready"_n, 1);
+    }
+}
+
+// the scopes are listed off chain, an empty legacy scope is a migrated one
+void token::migrateobill(name owner, uint64_t limit) {
+    if (!has_auth(owner)) {
+        check(has_auth(config_account), "only the owner and config account can migrate bills");
+    }
+    check(limit > 0, "invalid limit");
+    check(owner != get_self(), "the global scope is moved by billmigrate");
+    check(is_bill_book_ready(), "bill book migration in progress");
+
+    bill_stats legacy_tbl(get_self(), owner.value);
+    auto bill_iter = legacy_tbl.begin();
+    check(bill_iter != legacy_tbl.end(), "no legacy bills of this owner");
+
+    bill_table sst(get_self(), get_self().value);
+    for (uint64_t count = 0; bill_iter != legacy_tbl.end() && count < limit; count++) {
+        bill_record bill_info = *bill_iter;
+        // a fully matched bill has nothing left to list
+        if (bill_info.unmatched.quantity.amount == 0) {
+            bill_iter = legacy_tbl.erase(bill_iter);
+            continue;
+        }
+        bill_iter = move_bills(legacy_tbl, bill_iter, sst, 1, name(), [&](const bill_record& moved) {
+            change_bill_level(moved.price, moved.unmatched, 1);
+            EMIT_EVENT(*this, billsnap, {moved});
+        });
+    }
+}
+
+bool token::is_bill_book_ready() {
+    return get_dmc_config("bookready"_n, 0) != 0 && get_dmc_config("billready"_n, 0) != 0;
 }
 
 void token::getincentive(name owner, uint64_t bill_id) {
     require_auth(owner);
-    // TODO: delete it after
-    check(get_dmc_config("olderbillid"_n, default_id_start) <= bill_id, "this bill can only be unbilled");
-    uint64_t now_time_t = calbonus(owner, bill_id, owner);
-    bill_stats sst(get_self(), get_self().value);
+    uint64_t now_time_t = calbonus(owner, bill_id);
+    bill_table sst(get_self(), get_self().value);
     // check bill_id in calbouns, so no need to check here
     auto ust = sst.find(bill_id);
     check(ust != sst.end(), "no such record");
     sst.modify(ust, get_self(), [&](auto& s) {
         s.updated_at = time_point_sec(now_time_t);
     });
-    SEND_INLINE_ACTION(*this, billsnap, {_self, "active"_n}, {*ust});
+    EMIT_EVENT(*this, billsnap, {*ust});
+    settle_incentive(owner, bill_id);
 }
 
-uint64_t token::calbonus(name owner, uint64_t bill_id, name ram_payer) {
-    // TODO: delete it after
-    if (bill_id < get_dmc_config("olderbillid"_n, default_id_start)) {
-        bill_stats sst(get_self(), owner.value);
-        auto ust = sst.find(bill_id);
-        check(ust != sst.end(), "no such record");
-        dmc_makers maker_tbl(get_self(), get_self().value);
-        const auto& iter = maker_tbl.get(owner.value, "no such pst maker");
+void token::settleincent(name owner) {
+    require_auth(owner);
+    settle_incentive(owner, 0);
+}
 
-        auto now_time = time_point_sec(current_time_point());
-        uint64_t now_time_t = now_time.sec_since_epoch();
-        uint64_t updated_at_t = ust->updated_at.sec_since_epoch();
-        uint64_t bill_dmc_claims_interval = get_dmc_config("billinter"_n, default_bill_dmc_claims_interval);
-        uint64_t max_dmc_claims_interval = ust->created_at.sec_since_epoch() + bill_dmc_claims_interval;
-
-        now_time_t = now_time_t >= max_dmc_claims_interval ? max_dmc_claims_interval : now_time_t;
-
-        if (updated_at_t <= max_dmc_claims_interval) {
-            uint64_t duration = now_time_t - updated_at_t;
-            check(duration <= now_time_t, "subtractive overflow");  // never happened
-
-            extended_asset quantity = get_asset_by_amount<double, std::floor>(
-                incentive_rate * duration * ust->unmatched.quantity.amount * get_dmc_config("bmrate"_n, default_benchmark_stake_rate) / 100.0 / bill_dmc_claims_interval,
-                rsi_sym);
-
-            if (quantity.quantity.amount > 0) {
-                extended_asset dmc_quantity = get_dmc_by_vrsi(quantity);
-
-                if (dmc_quantity.quantity.amount > 0) {
-                    maker_tbl.modify(iter, ram_payer, [&](auto& s) {
-                        s.total_staked += dmc_quantity;
-                        s.current_rate = cal_current_rate(s.total_staked, owner, s.get_real_m());
-                    });
-                    SEND_INLINE_ACTION(*this, incentiverec, {_self, "active"_n}, {owner, dmc_quantity, bill_id});
-                }
-            } else {
-                // if quantity is 0, don't update updated_at
-                now_time_t = updated_at_t;
-            }
+uint64_t token::calbonus(name owner, uint64_t bill_id) {
+    bill_table sst(get_self(), get_self().value);
+    auto ust = sst.find(bill_id);
+    check(ust != sst.end(), "no such record");
+    check(ust->owner == owner, "bill_id not belong to you");
+    dmc_makers maker_tbl(get_self(), get_self().value);
+    check(maker_tbl.find(owner.value) != maker_tbl.end(), "no such pst maker");
+
+    auto now_time = time_point_sec(current_time_point());
+    uint64_t now_time_t = now_time.sec_since_epoch();
+    uint64_t updated_at_t = ust->updated_at.sec_since_epoch();
+    uint64_t bill_dmc_claims_interval = get_dmc_config("billinter"_n, default_bill_dmc_claims_interval);
+    uint64_t max_dmc_claims_interval = ust->created_at.sec_since_epoch() + bill_dmc_claims_interval;
+
+    now_time_t = now_time_t >= max_dmc_claims_interval ? max_dmc_claims_interval : now_time_t;
+
+    if (updated_at_t <= max_dmc_claims_interval) {
+        uint64_t duration = now_time_t - updated_at_t;
+        check(duration <= now_time_t, "subtractive overflow");  // never happened
+
+        extended_asset quantity = get_asset_by_amount<double, std::floor>(
+            incentive_rate * duration * ust->unmatched.quantity.amount * get_dmc_config("bmrate"_n, default_benchmark_stake_rate) / 100.0 / bill_dmc_claims_interval,
+            rsi_sym);
+
+        if (quantity.quantity.amount > 0) {
+            accrue_incentive(owner, quantity.quantity.amount);
+        } else {
+            // if quantity is 0, don't update updated_at
+            now_time_t = updated_at_t;
         }
-        return now_time_t;
+    }
+    return now_time_t;
+}
+
+// only arithmetic, so matching an order never swaps
+void token::accrue_incentive(name owner, int64_t rsi_amount) {
+    maker_incentives incentive_tbl(get_self(), get_self().value);
+    auto incentive_iter = incentive_tbl.find(owner.value);
+    if (incentive_iter == incentive_tbl.end()) {
+        incentive_tbl.emplace(get_self(), [&](auto& i) {
+            i.miner = owner;
+            i.pending_rsi = rsi_amount;
+        });
     } else {
-        bill_stats sst(get_self(), get_self().value);
-        auto ust = sst.find(bill_id);
-        check(ust != sst.end(), "no such record");
-        check(ust->owner == owner, "bill_id not belong to you");
+        incentive_tbl.modify(incentive_iter, get_self(), [&](auto& i) {
+            i.pending_rsi += rsi_amount;
+        });
+    }
+}
+
+void token::settle_incentive(name owner, uint64_t bill_id) {
+    maker_incentives incentive_tbl(get_self(), get_self().value);
+    auto incentive_iter = incentive_tbl.find(owner.value);
+    if (incentive_iter == incentive_tbl.end())
+        return;
+
+    extended_asset dmc_quantity = get_dmc_by_vrsi(extended_asset(incentive_iter->pending_rsi, rsi_sym));
+    incentive_tbl.erase(incentive_iter);
+    if (dmc_quantity.quantity.amount > 0) {
         dmc_makers maker_tbl(get_self(), get_self().value);
         const auto& iter = maker_tbl.get(owner.value, "no such pst maker");
-
-        auto now_time = time_point_sec(current_time_point());
-        uint64_t now_time_t = now_time.sec_since_epoch();
-        uint64_t updated_at_t = ust->updated_at.sec_since_epoch();
-        uint64_t bill_dmc_claims_interval = get_dmc_config("billinter"_n, default_bill_dmc_claims_interval);
-        uint64_t max_dmc_claims_interval = ust->created_at.sec_since_epoch() + bill_dmc_claims_interval;
-
-        now_time_t = now_time_t >= max_dmc_claims_interval ? max_dmc_claims_interval : now_time_t;
-
-        if (updated_at_t <= max_dmc_claims_interval) {
-            uint64_t duration = now_time_t - updated_at_t;
-            check(duration <= now_time_t, "subtractive overflow");  // never happened
-
-            extended_asset quantity = get_asset_by_amount<double, std::floor>(
-                incentive_rate * duration * ust->unmatched.quantity.amount * get_dmc_config("bmrate"_n, default_benchmark_stake_rate) / 100.0 / bill_dmc_claims_interval,
-                rsi_sym);
-
-            if (quantity.quantity.amount > 0) {
-                extended_asset dmc_quantity = get_dmc_by_vrsi(quantity);
-
-                if (dmc_quantity.quantity.amount > 0) {
-                    maker_tbl.modify(iter, ram_payer, [&](auto& s) {
-                        s.total_staked += dmc_quantity;
-                        s.current_rate = cal_current_rate(s.total_staked, owner, s.get_real_m());
-                    });
-                    SEND_INLINE_ACTION(*this, incentiverec, {_self, "active"_n}, {owner, dmc_quantity, bill_id});
-                }
-            } else {
-                // if quantity is 0, don't update updated_at
-                now_time_t = updated_at_t;
-            }
-        }
-        return now_time_t;
+        maker_tbl.modify(iter, owner, [&](auto& s) {
+            s.total_staked += dmc_quantity;
+            s.current_rate = cal_current_rate(s.total_staked, owner, s.get_real_m());
+        });
+        EMIT_EVENT(*this, makerecord, {iter});
+        EMIT_EVENT(*this, incentiverec, {owner, dmc_quantity, bill_id});
     }
 }
 
@@ -700,6 +936,15 @@ void token::setabostats(uint64_t stage, double user_rate, double foundation_rate
 
     abostats ast(get_self(), get_self().value);
     const auto& st = ast.find(stage);
+    abo_cursor_table cursor_tbl(get_self(), get_self().value);
+    auto cursor_iter = cursor_tbl.begin();
+    if (cursor_iter != cursor_tbl.end() && (cursor_iter->user_stage > stage || cursor_iter->foundation_stage > stage)) {
+        // the stage can be active again after its time range changes
+        cursor_tbl.modify(cursor_iter, get_self(), [&](auto& c) {
+            c.user_stage = std::min(c.user_stage, stage);
+            c.foundation_stage = std::min(c.foundation_stage, stage);
+        });
+    }
     if (st != ast.end()) {
         ast.modify(st, get_self(), [&](auto& a) {
             a.user_rate = user_rate;
@@ -707,6 +952,13 @@ void token::setabostats(uint64_t stage, double user_rate, double foundation_rate
             a.total_release = total_release;
             a.start_at = start_at;
             a.end_at = end_at;
+            if (a.user_remaining.has_value() && a.foundation_remaining.has_value()) {
+                // what both sides have left is split again by the new rates
+                int64_t remaining = *a.user_remaining + *a.foundation_remaining;
+                int64_t user_part = remaining * user_rate;
+                a.user_remaining.emplace(user_part);
+                a.foundation_remaining.emplace(remaining - user_part);
+            }
         });
     } else {
         ast.emplace(_self, [&](auto& a) {
@@ -719,65 +971,85 @@ void token::setabostats(uint64_t stage, double user_rate, double foundation_rate
             a.end_at = end_at;
             a.last_user_released_at = last_released_at;
             a.last_foundation_released_at = last_released_at;
+            int64_t user_part = remaining_release.quantity.amount * user_rate;
+            a.user_remaining.emplace(user_part);
+            a.foundation_remaining.emplace(remaining_release.quantity.amount - user_part);
         });
     }
 }
 
 void token::setdmcconfig(name key, uint64_t value) {
     require_auth(config_account);
-    dmc_global dmc_global_tbl(get_self(), get_self().value);
     switch (key.value) {
         case ("claiminter"_n).value:
             check(value > 0, "invalid claims interval");
             break;
+        case ("liqmakers"_n).value:
+        case ("liqbills"_n).value:
+            check(value > 0, "invalid liquidation budget");
+            break;
         default:
             break;
     }
-    auto config_itr = dmc_global_tbl.find(key.value);
-    if (config_itr == dmc_global_tbl.end()) {
-        dmc_global_tbl.emplace(_self, [&](auto& conf) {
-            conf.key = key;
-            conf.value = value;
-        });
-    } else {
-        dmc_global_tbl.modify(config_itr, get_self(), [&](auto& conf) {
-            conf.value = value;
-        });
-    }
+    set_dmc_config(key, value);
 }
 
 uint64_t token::get_dmc_config(name key, uint64_t default_value) {
-    dmc_global dmc_global_tbl(get_self(), get_self().value);
-    auto dmc_global_iter = dmc_global_tbl.find(key.value);
-    if (dmc_global_iter != dmc_global_tbl.end())
-        return dmc_global_iter->value;
-    return default_value;
+    auto cache_iter = _config_cache.find(key.value);
+    if (cache_iter == _config_cache.end()) {
+        DMC_PROFILE_COUNT(db_reads);
+        dmc_global dmc_global_tbl(get_self(), get_self().value);
+        auto dmc_global_iter = dmc_global_tbl.find(key.value);
+        bool exists = dmc_global_iter != dmc_global_tbl.end();
+        cache_iter = _config_cache.emplace(key.value, dmc_config_cache{exists ? dmc_global_iter->value : 0, exists, false}).first;
+    }
+    return cache_iter->second.exists ? cache_iter->second.value : default_value;
 }
 
 void token::set_dmc_config(name key, uint64_t value) {
+    _config_cache[key.value] = dmc_config_cache{value, true, true};
+}
+
+void token::flush_dmc_config() {
     dmc_global dmc_global_tbl(get_self(), get_self().value);
-    auto config_itr = dmc_global_tbl.find(key.value);
+    for (const auto& cache : _config_cache) {
+        if (!cache.second.dirty)
+            continue;
 
-    if (config_itr == dmc_global_tbl.end()) {
-        dmc_global_tbl.emplace(_self, [&](auto& conf) {
-            conf.key = key;
-            conf.value = value;
-        });
-    } else {
-        dmc_global_tbl.modify(config_itr, get_self(), [&](auto& conf) {
-            conf.value = value;
-        });
+        DMC_PROFILE_COUNT(db_reads);
+        auto config_itr = dmc_global_tbl.find(cache.first);
+        DMC_PROFILE_COUNT(db_writes);
+        if (config_itr == dmc_global_tbl.end()) {
+            dmc_global_tbl.emplace(_self, [&](auto& conf) {
+                conf.key = name(cache.first);
+                conf.value = cache.second.value;
+            });
+        } else {
+            dmc_global_tbl.modify(config_itr, get_self(), [&](auto& conf) {
+                conf.value = cache.second.value;
+            });
+        }
     }
+    _config_cache.clear();
 }
 
 double token::get_benchmark_price() {
-    bc_price_table bptb(get_self(), get_self().value);
-    auto bptb_iter = bptb.begin();
-    if (bptb_iter == bptb.end()) {
-        auto avg_price = get_dmc_config("initalprice"_n, default_initial_price) / 100.0;
-        return avg_price;
+    if (_benchmark_price_loaded)
+        return _benchmark_price;
+
+    bench_price_table price_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto price_iter = price_tbl.begin();
+    if (price_iter != price_tbl.end()) {
+        _benchmark_price = price_iter->benchmark_price;
+    } else {
+        bc_price_table bptb(get_self(), get_self().value);
+        DMC_PROFILE_COUNT(db_reads);
+        auto bptb_iter = bptb.begin();
+        _benchmark_price = bptb_iter == bptb.end() ? get_dmc_config("initalprice"_n, default_initial_price) / 100.0 : bptb_iter->benchmark_price;
     }
-    return bptb_iter->benchmark_price;
+    _benchmark_price_loaded = true;
+    return _benchmark_price;
 }
 
 double token::get_dmc_rate(uint64_t rate_value) {
@@ -785,118 +1057,211 @@ double token::get_dmc_rate(uint64_t rate_value) {
     return value * get_benchmark_price();
 }
 
-void token::trace_price_history(double price, uint64_t bill_id, uint64_t order_id) {
+void token::trace_price_history(uint64_t price) {
+    DMC_PROFILE_SCOPE(ScopePriceHistory);
     price_table ptb(get_self(), get_self().value);
-    auto iter = ptb.get_index<"bytime"_n>();
-    auto now_time = time_point_sec(current_time_point());
-    const uint64_t max_price_distance = get_dmc_config("pricedist"_n, default_max_price_distance);
+    DMC_PROFILE_COUNT(db_reads);
+    check(ptb.begin() == ptb.end(), "price history migration in progress");
+
+    price_median_table median_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto median_iter = median_tbl.begin();
+    price_median median = median_iter == median_tbl.end() ? price_median{0, 0, 0} : *median_iter;
+
+    uint64_t now_day = time_point_sec(current_time_point()).sec_since_epoch() / day_sec;
+    add_window_price(median, now_day, price);
+
+    // keep today and the latest ${pricedist} - 1 days which have prices
+    const uint64_t max_price_distance = std::max(get_dmc_config("pricedist"_n, default_max_price_distance), uint64_t(1));
+    while (median.days.size() > max_price_distance) {
+        DMC_PROFILE_COUNT(iterations);
+        evict_window_day(median);
+    }
 
-    std::vector<double> prices;
-    prices.push_back(price);
+    // convert to 4 decimal places
+    double bc_price = settle_price_median(median) / 10000.0;
+    DMC_PROFILE_COUNT(db_writes);
+    if (median_iter == median_tbl.end()) {
+        median_tbl.emplace(_self, [&](auto& m) {
+            m = median;
+        });
+    } else {
+        median_tbl.modify(median_iter, _self, [&](auto& m) {
+            m = median;
+        });
+    }
 
-    int times = 0;
-    auto rawtime = now_time;
-    for (auto it = iter.begin(); it != iter.end();) {
-        prices.push_back(it->price);
-        if (rawtime.sec_since_epoch() / day_sec != it->created_at.sec_since_epoch() / day_sec) {
-            times++;
-        }
-        if (times >= max_price_distance) {
-            // remove the oldest price
-            prices.pop_back();
-            it = iter.erase(it);
-        } else {
-            rawtime = it->created_at;
-            it++;
+    bench_price_table price_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto price_iter = price_tbl.begin();
+    DMC_PROFILE_COUNT(db_writes);
+    if (price_iter == price_tbl.end()) {
+        price_tbl.emplace(_self, [&](auto& a) {
+            a.benchmark_price = bc_price;
+        });
+        bc_price_table bptb(get_self(), get_self().value);
+        DMC_PROFILE_COUNT(db_reads);
+        auto bptb_iter = bptb.begin();
+        if (bptb_iter != bptb.end()) {
+            DMC_PROFILE_COUNT(db_writes);
+            bptb.erase(bptb_iter);
         }
+    } else {
+        price_tbl.modify(price_iter, _self, [&](auto& a) {
+            a.benchmark_price = bc_price;
+        });
     }
+    _benchmark_price = bc_price;
+    _benchmark_price_loaded = true;
+}
 
-    ptb.emplace(_self, [&](auto& p) {
-        p.primary = ptb.available_primary_key();
-        p.bill_id = bill_id;
-        p.order_id = order_id;
-        p.price = price;
-        p.created_at = now_time;
-    });
+void token::pricemigrate(uint64_t limit) {
+    require_auth(config_account);
+    check(limit > 0, "invalid limit");
+
+    price_table ptb(get_self(), get_self().value);
+    check(ptb.begin() != ptb.end(), "price history already migrated");
+
+    price_median_table median_tbl(get_self(), get_self().value);
+    auto median_iter = median_tbl.begin();
+    price_median median = median_iter == median_tbl.end() ? price_median{0, 0, 0} : *median_iter;
 
-    // calculate median price
-    std::sort(prices.begin(), prices.end());
-    auto size = prices.size();
-    double bc_price = 0;
-    if (size % 2 == 0) {
-        bc_price = (prices[size / 2 - 1] + prices[size / 2]) / 2;
+    for (auto it = ptb.begin(); it != ptb.end() && limit > 0; limit--) {
+        add_window_price(median, it->created_at.sec_since_epoch() / day_sec, std::round(it->price * 10000));
+        it = ptb.erase(it);
+    }
+    // the window is trimmed to ${pricedist} days by the next order
+    settle_price_median(median);
+
+    if (median_iter == median_tbl.end()) {
+        median_tbl.emplace(_self, [&](auto& m) {
+            m = median;
+        });
     } else {
-        bc_price = prices[size / 2];
+        median_tbl.modify(median_iter, _self, [&](auto& m) {
+            m = median;
+        });
     }
-    // convert to 4 decimal places
-    bc_price = std::floor(bc_price * 10000) / 10000.0;
-    bc_price_table bptb(get_self(), get_self().value);
-    auto bptb_iter = bptb.begin();
-    if (bptb_iter == bptb.end()) {
-        bptb_iter = bptb.emplace(_self, [&](auto& a) {
-            a.prices = prices;
-            a.benchmark_price = bc_price;
+}
+
+void token::add_window_price(price_median& median, uint64_t day, uint64_t price) {
+    price_counts count_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto count_iter = count_tbl.find(price);
+    DMC_PROFILE_COUNT(db_writes);
+    if (count_iter == count_tbl.end()) {
+        count_tbl.emplace(_self, [&](auto& c) {
+            c.price = price;
+            c.count = 1;
         });
     } else {
-        bptb.modify(bptb_iter, _self, [&](auto& a) {
-            a.prices = prices;
-            a.benchmark_price = bc_price;
+        count_tbl.modify(count_iter, _self, [&](auto& c) {
+            c.count += 1;
+        });
+    }
+
+    price_counts day_tbl(get_self(), day);
+    DMC_PROFILE_COUNT(db_reads);
+    auto day_iter = day_tbl.find(price);
+    DMC_PROFILE_COUNT(db_writes);
+    if (day_iter == day_tbl.end()) {
+        day_tbl.emplace(_self, [&](auto& c) {
+            c.price = price;
+            c.count = 1;
+        });
+    } else {
+        day_tbl.modify(day_iter, _self, [&](auto& c) {
+            c.count += 1;
         });
     }
+
+    auto day_pos = std::lower_bound(median.days.begin(), median.days.end(), day);
+    if (day_pos == median.days.end() || *day_pos != day) {
+        median.days.insert(day_pos, day);
+    }
+
+    if (median.total == 0) {
+        median.median_price = price;
+        median.below = 0;
+    } else if (price < median.median_price) {
+        median.below += 1;
+    }
+    median.total += 1;
 }
 
-void token::adjustprice(string memo) {
-    bc_price_table bptb(get_self(), get_self().value);
-    auto bptb_iter = bptb.begin();
-    if (bptb_iter == bptb.end()) {
-        return;
+void token::evict_window_day(price_median& median) {
+    price_counts count_tbl(get_self(), get_self().value);
+    price_counts day_tbl(get_self(), median.days.front());
+    DMC_PROFILE_COUNT(db_reads);
+    for (auto day_iter = day_tbl.begin(); day_iter != day_tbl.end();) {
+        DMC_PROFILE_COUNT(db_reads);
+        auto count_iter = count_tbl.find(day_iter->price);
+        check(count_iter != count_tbl.end() && count_iter->count >= day_iter->count, "price window out of sync");  // never happened
+        DMC_PROFILE_COUNT(db_writes);
+        if (count_iter->count == day_iter->count) {
+            count_tbl.erase(count_iter);
+        } else {
+            count_tbl.modify(count_iter, _self, [&](auto& c) {
+                c.count -= day_iter->count;
+            });
+        }
+
+        if (day_iter->price < median.median_price) {
+            median.below -= day_iter->count;
+        }
+        median.total -= day_iter->count;
+        DMC_PROFILE_COUNT(db_writes);
+        day_iter = day_tbl.erase(day_iter);
     }
-    bptb.modify(bptb_iter, _self, [&](auto& a) {
-        a.benchmark_price = std::floor(a.benchmark_price * 10000) / 10000.0;
-    });
+    median.days.erase(median.days.begin());
+}
+
+uint64_t token::settle_price_median(price_median& median) {
+    if (median.total == 0) {
+        return 0;
+    }
+
+    // move from the last median to the bucket holding the ${k}th price,
+    // a few prices changed since, so it moves only a few buckets
+    price_counts count_tbl(get_self(), get_self().value);
+    uint64_t k = (median.total - 1) / 2;
+    DMC_PROFILE_COUNT(db_reads);
+    auto it = count_tbl.lower_bound(median.median_price);
+    if (it == count_tbl.end()) {
+        DMC_PROFILE_COUNT(iterations);
+        it--;
+        median.below -= it->count;
+    }
+    while (k < median.below) {
+        DMC_PROFILE_COUNT(iterations);
+        it--;
+        median.below -= it->count;
+    }
+    while (k >= median.below + it->count) {
+        median.below += it->count;
+        DMC_PROFILE_COUNT(iterations);
+        it++;
+    }
+    median.median_price = it->price;
+
+    uint64_t upper_price = median.median_price;
+    if (median.total % 2 == 0 && k + 1 >= median.below + it->count) {
+        DMC_PROFILE_COUNT(iterations);
+        it++;
+        upper_price = it->price;
+    }
+    return (median.median_price + upper_price) / 2;
 }
 
 void token::allocation(string memo) {
     require_auth(dmc_account);
     check(memo.size() <= 256, "memo has more than 256 bytes");
-    abostats ast(get_self(), get_self().value);
-    extended_asset to_foundation(0, dmc_sym);
 
+    // the foundation side of the active stage is released at most once a day
     auto now_time = time_point_sec(current_time_point());
-    for (auto it = ast.begin(); it != ast.end();) {
-        if (now_time > it->end_at) {
-            if (it->remaining_release.quantity.amount != 0) {
-                to_foundation.quantity.amount = it->remaining_release.quantity.amount * it->foundation_rate;
-                ast.modify(it, get_self(), [&](auto& a) {
-                    a.last_foundation_released_at = it->end_at;
-                    a.remaining_release -= to_foundation;
-                });
-            }
-            it++;
-        } else if (now_time < it->start_at) {
-            break;
-        } else {
-            auto duration_time = now_time.sec_since_epoch() - it->last_foundation_released_at.sec_since_epoch();
-            if (duration_time / 86400 == 0)  // 24 * 60 * 60
-                break;
-            auto remaining_time = it->end_at.sec_since_epoch() - it->last_foundation_released_at.sec_since_epoch();
-            double per = (double)duration_time / (double)remaining_time;
-            if (per > 1)
-                per = 1;
-            uint64_t total_asset_amount = per * it->remaining_release.quantity.amount * it->foundation_rate;
-            if (total_asset_amount != 0) {
-                extended_asset curr_release(total_asset_amount, dmc_sym);
-                to_foundation += curr_release;
-                ast.modify(it, get_self(), [&](auto& a) {
-                    a.last_foundation_released_at = now_time;
-                    a.remaining_release -= curr_release;
-                });
-            }
-            break;
-        }
-    }
-
+    extended_asset to_foundation = release_abo(now_time, false, 86400);  // 24 * 60 * 60
     if (to_foundation.quantity.amount != 0) {
+        DMC_PROFILE_COUNT(inlines);
         SEND_INLINE_ACTION(*this, issue, {dmc_account, "active"_n}, {system_account, to_foundation.quantity, "allocation to foundation"});
     }
 }
@@ -1,56 +1,137 @@
 #include <dmc.token/dmc.token.hpp>
+#include <dmc.token/merkle.hpp>
 #include <eosio/transaction.hpp>
 #include <string.h>
 
 namespace eosio {
 
-void token::phishing_challenge() {
-    dmc_global dmc_global_tbl(get_self(), get_self().value);
-    auto phishing_date_iter = dmc_global_tbl.find("phishdate"_n.value);
-    time_point_sec phishing_date;
-    if (phishing_date_iter != dmc_global_tbl.end())
-        phishing_date = time_point_sec(phishing_date_iter->value);
-    else {
-        phishing_date = time_point_sec(current_time_point());
-        dmc_global_tbl.emplace(_self, [&](auto& conf) {
-            conf.key = "phishdate"_n;
-            conf.value = current_time_point().sec_since_epoch();
+// orders that can be challenged, they stay in the phishing pool from delivery until they are ended or canceled
+bool token::is_phishing_state(OrderState state) {
+    return state == OrderStateDeliver || state == OrderStatePreCont || state == OrderStatePreEnd;
+}
+
+token::phishing_state token::get_phishing_state() {
+    phishing_state_table state_tbl(get_self(), get_self().value);
+    auto state_iter = state_tbl.begin();
+    if (state_iter != state_tbl.end()) {
+        return *state_iter;
+    }
+    // the first draw keeps the schedule of phishdate
+    uint64_t phishing_date = get_dmc_config("phishdate"_n, 0);
+    if (phishing_date == 0) {
+        phishing_date = current_time_point().sec_since_epoch();
+    }
+    return phishing_state{time_point_sec(phishing_date + get_dmc_config("phishinter"_n, default_phishing_interval)), 0};
+}
+
+void token::save_phishing_state(const phishing_state& state) {
+    phishing_state_table state_tbl(get_self(), get_self().value);
+    auto state_iter = state_tbl.begin();
+    if (state_iter == state_tbl.end()) {
+        state_tbl.emplace(get_self(), [&](auto& s) {
+            s = state;
+        });
+    } else {
+        state_tbl.modify(state_iter, get_self(), [&](auto& s) {
+            s = state;
         });
     }
-    
-    auto phishing_interval_iter = dmc_global_tbl.find("phishinter"_n.value);
-    uint64_t phishing_interval = default_phishing_interval;
-    if (phishing_interval_iter != dmc_global_tbl.end()) {
-        phishing_interval = phishing_interval_iter->value;
+}
+
+void token::add_phishing_candidate(uint64_t order_id) {
+    phishing_candidates candidate_tbl(get_self(), get_self().value);
+    auto order_idx = candidate_tbl.get_index<"byorder"_n>();
+    if (order_idx.find(order_id) != order_idx.end()) {
+        return;
+    }
+    phishing_state state = get_phishing_state();
+    candidate_tbl.emplace(get_self(), [&](auto& c) {
+        c.index = state.candidate_count;
+        c.order_id = order_id;
+    });
+    state.candidate_count++;
+    save_phishing_state(state);
+}
+
+// the last candidate takes the place of the removed one, so the indices stay dense
+void token::remove_phishing_candidate(uint64_t order_id) {
+    phishing_candidates candidate_tbl(get_self(), get_self().value);
+    auto order_idx = candidate_tbl.get_index<"byorder"_n>();
+    auto order_iter = order_idx.find(order_id);
+    if (order_iter == order_idx.end()) {
+        return;
     }
-    if (phishing_date + phishing_interval > time_point_sec(current_time_point())) {
+    phishing_state state = get_phishing_state();
+    check(state.candidate_count > 0, "phishing pool is empty");  // never happened
+    uint64_t last_index = state.candidate_count - 1;
+    if (order_iter->index == last_index) {
+        order_idx.erase(order_iter);
+    } else {
+        auto last_iter = candidate_tbl.find(last_index);
+        check(last_iter != candidate_tbl.end(), "phishing pool is broken");  // never happened
+        uint64_t last_order_id = last_iter->order_id;
+        candidate_tbl.erase(last_iter);
+        order_idx.modify(order_iter, get_self(), [&](auto& c) {
+            c.order_id = last_order_id;
+        });
+    }
+    state.candidate_count--;
+    save_phishing_state(state);
+}
+
+void token::phishing_challenge() {
+    phishing_state_table state_tbl(get_self(), get_self().value);
+    auto state_iter = state_tbl.begin();
+    time_point_sec now_time = time_point_sec(current_time_point());
+    if (state_iter != state_tbl.end() && state_iter->next_at > now_time) {
         return;
     }
 
-    dmc_orders order_tbl(get_self(), get_self().value);
-    if (order_tbl.begin() == order_tbl.end()) {
+    phishing_state state = get_phishing_state();
+    if (state.next_at > now_time) {
+        save_phishing_state(state);
+        return;
+    }
+    // one draw per interval whatever it hits, so the rate does not depend on the pool
+    state.next_at = now_time + get_dmc_config("phishinter"_n, default_phishing_interval);
+    save_phishing_state(state);
+    if (state.candidate_count == 0) {
         return;
     }
-    uint64_t order_id_begin = order_tbl.begin()->order_id;
-    uint64_t order_id_end = get_dmc_config("orderid"_n, default_id_start);
+
     uint64_t tpos_mult = uint64_t(tapos_block_prefix()) * tapos_block_num();
-    uint64_t rand = tpos_mult % (order_id_end - order_id_begin);
-    uint64_t order_id = order_id_begin + rand;
-
-    auto state_id_idx = order_tbl.get_index<"stateid"_n>();
-    auto state_id_iter = state_id_idx.lower_bound(dmc_order::get_state_id(OrderStateDeliver, order_id));
-    if (state_id_iter != state_id_idx.end() && state_id_iter->state == OrderStateDeliver) {
-        dmc_challenges challenge_tbl(get_self(), get_self().value);
-        auto challenge_iter = challenge_tbl.find(state_id_iter->order_id);
-        if (is_challenge_end(challenge_iter->state) && challenge_iter->data_block_count) {
-            auto challenge_hash = sha256((char*)&tpos_mult, sizeof(uint64_t));
-            uint64_t data_id = uint64_t(*reinterpret_cast<const uint64_t*>(&challenge_hash)) % challenge_iter->data_block_count;
-            SEND_INLINE_ACTION(*this, reqchallenge, { _self, "active"_n }, { _self, state_id_iter->order_id, data_id, challenge_hash, std::string("phishing")});
-            dmc_global_tbl.modify(phishing_date_iter, get_self(), [&](auto& d) {
-                d.value = current_time_point().sec_since_epoch();
-            });
+    phishing_candidates candidate_tbl(get_self(), get_self().value);
+    auto candidate_iter = candidate_tbl.find(tpos_mult % state.candidate_count);
+    check(candidate_iter != candidate_tbl.end(), "phishing pool is broken");  // never happened
+
+    dmc_challenges challenge_tbl(get_self(), get_self().value);
+    auto challenge_iter = challenge_tbl.find(candidate_iter->order_id);
+    if (challenge_iter != challenge_tbl.end() && is_challenge_end(challenge_iter->state) && challenge_iter->data_block_count) {
+        auto challenge_hash = sha256((char*)&tpos_mult, sizeof(uint64_t));
+        uint64_t data_id = uint64_t(*reinterpret_cast<const uint64_t*>(&challenge_hash)) % challenge_iter->data_block_count;
+        DMC_PROFILE_COUNT(inlines);
+        SEND_INLINE_ACTION(*this, reqchallenge, { _self, "active"_n }, { _self, candidate_iter->order_id, data_id, challenge_hash, std::string("phishing")});
+    }
+}
+
+void token::phishmigrate(uint64_t limit) {
+    require_auth(config_account);
+    check(limit > 0, "invalid limit");
+    check(get_dmc_config("phishready"_n, 0) == 0, "phishing pool already migrated");
+
+    order_hots order_tbl(get_self(), get_self().value);
+    auto order_iter = order_tbl.lower_bound(get_dmc_config("phishcursor"_n, 0));
+    for (uint64_t count = 0; order_iter != order_tbl.end() && count < limit; count++, order_iter++) {
+        if (is_phishing_state(order_iter->state)) {
+            add_phishing_candidate(order_iter->order_id);
         }
     }
+
+    if (order_iter == order_tbl.end()) {
+        set_dmc_config("phishready"_n, 1);
+    } else {
+        set_dmc_config("phishcursor"_n, order_iter->order_id);
+    }
 }
 
 ChallengeState token::get_challenge_state(uint64_t order_id)
@@ -76,10 +157,8 @@ void token::addmerkle(name sender, uint64_t order_id, checksum256 merkle_root, u
 {
     require_auth(sender);
 
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
-    check(sender == order_iter->user || sender == order_iter->miner, "order doesn't belong to sender");
+    auto order = get_order(order_id);
+    check(sender == order.user || sender == order.miner, "order doesn't belong to sender");
 
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
@@ -105,12 +184,9 @@ void token::addmerkle(name sender, uint64_t order_id, checksum256 merkle_root, u
                 c.pre_merkle_root = checksum256();
             });
 
-            dmc_order order = *order_iter;
             update_order(order, *challenge_iter, sender);
-            order_tbl.modify(order_iter, sender, [&](auto& o) {
-                o = order;
-            });
-            SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { *order_iter, 2});
+            store_order(order, sender);
+            EMIT_EVENT(*this, orderrec, { order, 2 });
         } else {
             challenge_tbl.modify(challenge_iter, sender, [&](auto& c) {
                 c.merkle_submitter = name { _self };
@@ -121,16 +197,14 @@ void token::addmerkle(name sender, uint64_t order_id, checksum256 merkle_root, u
             });
         }
     }
-    SEND_INLINE_ACTION(*this, challengerec, { _self, "active"_n }, { *challenge_iter });
+    EMIT_EVENT(*this, challengerec, { *challenge_iter });
 }
 
 void token::reqchallenge(name sender, uint64_t order_id, uint64_t data_id, checksum256 hash_data, std::string nonce)
 {
     require_auth(sender);
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
-    check(sender == order_iter->user || sender == get_self(), "only user can reqchallenge");
+    auto order = get_order(order_id);
+    check(sender == order.user || sender == get_self(), "only user can reqchallenge");
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
     check(challenge_iter != challenge_tbl.end(), "can't find challenge");
@@ -138,21 +212,18 @@ void token::reqchallenge(name sender, uint64_t order_id, uint64_t data_id, check
     check(is_challenge_end(state), "invalid challenge state, cannot reqchallenge");
     check(data_id < challenge_iter->data_block_count, "invalid data number");
 
-    auto order = *order_iter;
     update_order(order, *challenge_iter, sender);
     check(order.state == OrderStateDeliver || order.state == OrderStatePreEnd || order.state == OrderStatePreCont, "order state is invalid, can't reqchallenge");
 
-    auto per_price_amount = double(order_iter->price.quantity.amount) * 0.1 / (order_iter->miner_lock_pst.quantity.amount / pow(10, pst_sym.get_symbol().precision()));
-    auto user_lock = extended_asset(per_price_amount * 100, order_iter->price.get_extended_symbol());
+    auto per_price_amount = double(order.price.quantity.amount) * 0.1 / (order.miner_lock_pst.quantity.amount / pow(10, pst_sym.get_symbol().precision()));
+    auto user_lock = extended_asset(per_price_amount * 100, order.price.get_extended_symbol());
     if (sender == get_self()) {
         user_lock = extended_asset(0, user_lock.get_extended_symbol());
     }
 
     check(order.user_pledge >= user_lock, "not enough dmc to challenge");
     order.user_pledge -= user_lock;
-    order_tbl.modify(order_iter, sender, [&](auto& o) {
-        o = order;
-    });
+    store_order(order, sender);
 
     challenge_tbl.modify(challenge_iter, sender, [&](auto& c) {
         c.data_id = data_id;
@@ -165,10 +236,10 @@ void token::reqchallenge(name sender, uint64_t order_id, uint64_t data_id, check
         c.challenger = sender;
     });
     if (user_lock.quantity.amount > 0) {
-        SEND_INLINE_ACTION(*this, orderassrec, { _self, "active"_n }, { order_id, { {-user_lock, OrderReceiptChallengeReq}}, order.user,  ACC_TYPE_USER, challenge_iter->challenge_date});
+        EMIT_EVENT(*this, orderassrec, { order_id, { {-user_lock, OrderReceiptChallengeReq}}, order.user,  ACC_TYPE_USER, challenge_iter->challenge_date});
     }
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { *order_iter, 2 });
-    SEND_INLINE_ACTION(*this, challengerec, { _self, "active"_n }, { *challenge_iter });
+    EMIT_EVENT(*this, orderrec, { order, 2 });
+    EMIT_EVENT(*this, challengerec, { *challenge_iter });
 }
 
 void token::anschallenge(name sender, uint64_t order_id, checksum256 reply_hash)
@@ -176,10 +247,8 @@ void token::anschallenge(name sender, uint64_t order_id, checksum256 reply_hash)
     require_auth(sender);
 
     check(get_challenge_state(order_id) == ChallengeRequest, "invalid state, cannot reply");
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
-    check(sender == order_iter->miner, "only miner can reply proof");
+    auto order = get_order(order_id);
+    check(sender == order.miner, "only miner can reply proof");
 
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
@@ -190,16 +259,15 @@ void token::anschallenge(name sender, uint64_t order_id, checksum256 reply_hash)
 
     check(checksum_data == challenge_iter->hash_data, "invalid reply hash data");
 
-    auto per_price_amount = double(order_iter->price.quantity.amount) * 0.1 / (order_iter->miner_lock_pst.quantity.amount / pow(10, pst_sym.get_symbol().precision()));
-    auto user_pay = extended_asset(per_price_amount, order_iter->price.get_extended_symbol());
+    auto per_price_amount = double(order.price.quantity.amount) * 0.1 / (order.miner_lock_pst.quantity.amount / pow(10, pst_sym.get_symbol().precision()));
+    auto user_pay = extended_asset(per_price_amount, order.price.get_extended_symbol());
     if (challenge_iter->challenger == get_self()){
-        user_pay = extended_asset(0,  order_iter->price.get_extended_symbol());
+        user_pay = extended_asset(0,  order.price.get_extended_symbol());
     }
 
-    auto order = *order_iter;
     order.user_pledge += challenge_iter->user_lock - user_pay;
     if ((challenge_iter->user_lock - user_pay).quantity.amount != 0) {
-        SEND_INLINE_ACTION(*this, orderassrec, { _self, "active"_n }, { order_id, {{challenge_iter->user_lock - user_pay, OrderReceiptChallengeAns}}, order.user,  ACC_TYPE_USER, time_point_sec(current_time_point())});
+        EMIT_EVENT(*this, orderassrec, { order_id, {{challenge_iter->user_lock - user_pay, OrderReceiptChallengeAns}}, order.user,  ACC_TYPE_USER, time_point_sec(current_time_point())});
     }
 
     increase_penalty(user_pay);
@@ -211,11 +279,9 @@ void token::anschallenge(name sender, uint64_t order_id, checksum256 reply_hash)
     });
 
     update_order(order, *challenge_iter, sender);
-    order_tbl.modify(order_iter, sender, [&](auto& o) {
-        o = order;
-    });
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { *order_iter, 2 });
-    SEND_INLINE_ACTION(*this, challengerec, { _self, "active"_n }, { *challenge_iter });
+    store_order(order, sender);
+    EMIT_EVENT(*this, orderrec, { order, 2 });
+    EMIT_EVENT(*this, challengerec, { *challenge_iter });
 }
 
 void token::arbitration(name sender, uint64_t order_id, const std::vector<char>& data, std::vector<checksum256> cut_merkle)
@@ -223,45 +289,24 @@ void token::arbitration(name sender, uint64_t order_id, const std::vector<char>&
     require_auth(sender);
 
     check(get_challenge_state(order_id) == ChallengeRequest, "invalid state, cannot arbitration");
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
+    auto order = get_order(order_id);
 
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
     check(challenge_iter != challenge_tbl.end(), "can't find challenge");
 
-    std::vector<char> copy_data = data;
-    checksum256 checksum_data = sha256((char*)&copy_data[0], copy_data.size());
-    copy_data.insert(copy_data.end(), challenge_iter->nonce.begin(), challenge_iter->nonce.end());
-    checksum256 pre_hash_data = sha256((char*)&copy_data[0], copy_data.size());
+    checksum256 checksum_data = sha256(data.data(), data.size());
+    checksum256 pre_hash_data = merkle::hash_with_nonce(data, challenge_iter->nonce);
     auto pre_hash_bytes = pre_hash_data.extract_as_byte_array();
     checksum256 hash_data = sha256((char*)&pre_hash_bytes[0], pre_hash_bytes.size());
-    auto hash_bytes = checksum_data.extract_as_byte_array();
-    uint64_t id_tmp = challenge_iter->data_id;
-
-    for (auto iter = cut_merkle.begin(); iter != cut_merkle.end(); iter++) {
-        std::vector<char> mixed_hash;
-        auto iter_hash_bytes = (*iter).extract_as_byte_array();
-        auto pos = id_tmp % 2;
-        if (!pos) {
-            mixed_hash.insert(mixed_hash.begin(), &hash_bytes[0], (&hash_bytes[0]) + hash_bytes.size());
-            mixed_hash.insert(mixed_hash.begin() + hash_bytes.size(), &(iter_hash_bytes[0]), (&(iter_hash_bytes[0])) + iter_hash_bytes.size());
-        } else {
-            mixed_hash.insert(mixed_hash.begin(), &(iter_hash_bytes[0]), (&(iter_hash_bytes[0])) + iter_hash_bytes.size());
-            mixed_hash.insert(mixed_hash.begin() + hash_bytes.size(), &(hash_bytes[0]), (&(hash_bytes[0])) + hash_bytes.size());
-        }
-        checksum_data = sha256((char*)&mixed_hash[0], mixed_hash.size());
-        hash_bytes = checksum_data.extract_as_byte_array();
-        id_tmp /= 2;
-    }
-    check(checksum_data == challenge_iter->merkle_root, "merkle root mismatch!");
 
-    auto per_price_amount = double(order_iter->price.quantity.amount) * 0.1 / (order_iter->miner_lock_pst.quantity.amount / pow(10, pst_sym.get_symbol().precision()));
-    auto miner_pay = extended_asset(per_price_amount, order_iter->price.get_extended_symbol());
-    auto user_pay = extended_asset(per_price_amount * 100, order_iter->price.get_extended_symbol());
+    check(merkle::verify(checksum_data, {challenge_iter->data_id, std::move(cut_merkle)}, challenge_iter->merkle_root), "merkle root mismatch!");
+
+    auto per_price_amount = double(order.price.quantity.amount) * 0.1 / (order.miner_lock_pst.quantity.amount / pow(10, pst_sym.get_symbol().precision()));
+    auto miner_pay = extended_asset(per_price_amount, order.price.get_extended_symbol());
+    auto user_pay = extended_asset(per_price_amount * 100, order.price.get_extended_symbol());
     if (challenge_iter->challenger == get_self()){
-        user_pay = extended_asset(0, order_iter->price.get_extended_symbol());
+        user_pay = extended_asset(0, order.price.get_extended_symbol());
     }
 
     ChallengeState state = ChallengeArbitrationUserPay;
@@ -272,12 +317,11 @@ void token::arbitration(name sender, uint64_t order_id, const std::vector<char>&
         user_pay = tmp;
     }
 
-    auto order = *order_iter;
     order.user_pledge += challenge_iter->user_lock - user_pay;
 
     increase_penalty(user_pay);
     if ((challenge_iter->user_lock - user_pay).quantity.amount != 0) {
-        SEND_INLINE_ACTION(*this, orderassrec, { _self, "active"_n }, { order_id, { {challenge_iter->user_lock - user_pay, OrderReceiptChallengeArb} }, order.user,  ACC_TYPE_USER, time_point_sec(current_time_point())});
+        EMIT_EVENT(*this, orderassrec, { order_id, { {challenge_iter->user_lock - user_pay, OrderReceiptChallengeArb} }, order.user,  ACC_TYPE_USER, time_point_sec(current_time_point())});
     }
     
     challenge_tbl.modify(challenge_iter, sender, [&](auto& o) {
@@ -288,20 +332,16 @@ void token::arbitration(name sender, uint64_t order_id, const std::vector<char>&
 
     update_order(order, *challenge_iter, sender);
 
-    order_tbl.modify(order_iter, sender, [&](auto& o) {
-        o = order;
-    });
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { *order_iter, 2 });
-    SEND_INLINE_ACTION(*this, challengerec, { _self, "active"_n }, { *challenge_iter });
+    store_order(order, sender);
+    EMIT_EVENT(*this, orderrec, { order, 2 });
+    EMIT_EVENT(*this, challengerec, { *challenge_iter });
 }
 
 void token::paychallenge(name sender, uint64_t order_id)
 {
     require_auth(sender);
 
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
+    auto order_info = get_order(order_id);
     uint64_t challenge_interval = get_dmc_config("challinter"_n, default_dmc_challenge_interval);
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
@@ -310,26 +350,29 @@ void token::paychallenge(name sender, uint64_t order_id)
     check(challenge_iter->state == ChallengeRequest, "invalid state, can't pay challenge!");
     check(challenge_iter->challenge_date + challenge_interval <= time_point_sec(current_time_point()), "challange doesn't reach expire time!");
 
-    dmc_order order_info = *order_iter;
     auto miner_arbitration = order_info.miner_lock_dmc;
+    // the lock goes to the user, the maker no longer counts it
+    maker_reward reward = get_maker_reward(order_info.miner);
+    reward.locked -= std::min(reward.locked, miner_arbitration.quantity.amount);
+    set_maker_reward(reward);
 
     auto system_reward = extended_asset(miner_arbitration.quantity.amount * 0.5, miner_arbitration.get_extended_symbol());
     increase_penalty(system_reward);
     
     add_balance(order_info.user,  (miner_arbitration - system_reward) + order_info.deposit, sender);
     if (order_info.deposit.quantity.amount > 0) {
-         SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n }, { order_id, { order_info.deposit }, order_info.user, AssetReceiptDeposit});
+         EMIT_EVENT(*this, assetrec, { order_id, { order_info.deposit }, order_info.user, AssetReceiptDeposit});
          order_info.deposit = extended_asset(0, order_info.deposit.get_extended_symbol());
     }
-    SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n }, { order_id, { miner_arbitration - system_reward }, order_info.user, AssetReceiptPayChallenge});
+    EMIT_EVENT(*this, assetrec, { order_id, { miner_arbitration - system_reward }, order_info.user, AssetReceiptPayChallenge});
     delete_order_pst(order_info);
     order_info.miner_lock_dmc = extended_asset(0, dmc_sym);
     order_info.lock_pledge -= order_info.price;
     order_info.user_pledge += challenge_iter->user_lock + order_info.price;
     order_info.state = OrderStateEnd;
-    SEND_INLINE_ACTION(*this, orderassrec, { _self, "active"_n }, { order_id, { {order_info.price, OrderReceiptLockRet} }, order_info.user, ACC_TYPE_USER, time_point_sec(current_time_point())});
+    EMIT_EVENT(*this, orderassrec, { order_id, { {order_info.price, OrderReceiptLockRet} }, order_info.user, ACC_TYPE_USER, time_point_sec(current_time_point())});
     if (challenge_iter->user_lock.quantity.amount != 0) {
-        SEND_INLINE_ACTION(*this, orderassrec, { _self, "active"_n }, { order_id, { {challenge_iter->user_lock, OrderReceiptPayChallengeRet} }, order_info.user,  ACC_TYPE_USER, time_point_sec(current_time_point())});
+        EMIT_EVENT(*this, orderassrec, { order_id, { {challenge_iter->user_lock, OrderReceiptPayChallengeRet} }, order_info.user,  ACC_TYPE_USER, time_point_sec(current_time_point())});
     }
 
     bool deleted = false;
@@ -337,7 +380,7 @@ void token::paychallenge(name sender, uint64_t order_id)
         (!order_info.miner_lock_dmc.quantity.amount) && (!order_info.settlement_pledge.quantity.amount)) {
             if (order_info.user_pledge.quantity.amount) {
                 add_balance(order_info.user, order_info.user_pledge, sender);
-                SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n }, { order_id, { order_info.user_pledge }, order_info.user, AssetReceiptSubReserve});
+                EMIT_EVENT(*this, assetrec, { order_id, { order_info.user_pledge }, order_info.user, AssetReceiptSubReserve});
                 order_info.user_pledge = extended_asset(0, order_info.user_pledge.get_extended_symbol());
             }
             deleted = true;
@@ -347,19 +390,17 @@ void token::paychallenge(name sender, uint64_t order_id)
     challenge.state = ChallengeTimeout;
     challenge.user_lock = extended_asset(0, challenge.user_lock.get_extended_symbol());
     if (deleted) {
-        order_tbl.erase(order_iter);
+        erase_order(order_id);
         challenge_tbl.erase(challenge_iter);
         delete_maker_snapshot(order_id);
     } else {
-        order_tbl.modify(order_iter, sender, [&](auto& o) {
-            o = order_info;
-        });
+        store_order(order_info, sender);
         challenge_tbl.modify(challenge_iter, sender, [&](auto& c) {
             c = challenge;
         });
     }
 
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { order_info, 2 });
-    SEND_INLINE_ACTION(*this, challengerec, { _self, "active"_n }, { challenge });
+    EMIT_EVENT(*this, orderrec, { order_info, 2 });
+    EMIT_EVENT(*this, challengerec, { challenge });
 }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
  */
 
 #include <dmc.token/dmc.token.hpp>
+#include <algorithm>
 
 namespace eosio {
 
@@ -15,7 +16,138 @@ void token::delete_order_pst(const dmc_order& order) {
     send_totalvote_to_system(order.miner);
 }
 
-void token::update_order_asset(dmc_order& order, OrderState new_state, uint64_t claims_interval) {
+token::dmc_order token::get_order(uint64_t order_id) {
+    order_hots hot_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto hot_iter = hot_tbl.find(order_id);
+    if (hot_iter == hot_tbl.end()) {
+        dmc_orders legacy_tbl(get_self(), get_self().value);
+        DMC_PROFILE_COUNT(db_reads);
+        auto legacy_iter = legacy_tbl.find(order_id);
+        check(legacy_iter != legacy_tbl.end(), "can't find order");
+        return *legacy_iter;
+    }
+    order_colds cold_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    const auto& cold = cold_tbl.get(order_id, "can't find order");
+    return dmc_order {
+        .order_id = order_id,
+        .user = cold.user,
+        .miner = cold.miner,
+        .bill_id = cold.bill_id,
+        .user_pledge = extended_asset(hot_iter->user_pledge, dmc_sym),
+        .miner_lock_pst = extended_asset(cold.miner_lock_pst, pst_sym),
+        .miner_lock_dmc = extended_asset(hot_iter->miner_lock_dmc, dmc_sym),
+        .price = extended_asset(cold.price, dmc_sym),
+        .settlement_pledge = extended_asset(hot_iter->settlement_pledge, dmc_sym),
+        .lock_pledge = extended_asset(hot_iter->lock_pledge, dmc_sym),
+        .state = hot_iter->state,
+        .deliver_start_date = hot_iter->deliver_start_date,
+        .latest_settlement_date = hot_iter->latest_settlement_date,
+        .miner_lock_rsi = extended_asset(hot_iter->miner_lock_rsi, rsi_sym),
+        .miner_rsi = extended_asset(hot_iter->miner_rsi, rsi_sym),
+        .user_rsi = extended_asset(hot_iter->user_rsi, rsi_sym),
+        .deposit = extended_asset(hot_iter->deposit, dmc_sym),
+        .epoch = cold.epoch,
+        .deposit_valid = hot_iter->deposit_valid,
+        .cancel_date = hot_iter->cancel_date,
+    };
+}
+
+// only the hot row is written once the order is stored, the cold row never changes
+void token::store_order(const dmc_order& order, name payer) {
+    auto write_hot = [&](auto& h) {
+        h.order_id = order.order_id;
+        h.state = order.state;
+        h.user_pledge = order.user_pledge.quantity.amount;
+        h.miner_lock_dmc = order.miner_lock_dmc.quantity.amount;
+        h.settlement_pledge = order.settlement_pledge.quantity.amount;
+        h.lock_pledge = order.lock_pledge.quantity.amount;
+        h.deposit = order.deposit.quantity.amount;
+        h.miner_lock_rsi = order.miner_lock_rsi.quantity.amount;
+        h.miner_rsi = order.miner_rsi.quantity.amount;
+        h.user_rsi = order.user_rsi.quantity.amount;
+        h.deliver_start_date = order.deliver_start_date;
+        h.latest_settlement_date = order.latest_settlement_date;
+        h.deposit_valid = order.deposit_valid;
+        h.cancel_date = order.cancel_date;
+    };
+
+    order_hots hot_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto hot_iter = hot_tbl.find(order.order_id);
+    if (hot_iter != hot_tbl.end()) {
+        bool was_candidate = is_phishing_state(hot_iter->state);
+        DMC_PROFILE_COUNT(db_writes);
+        hot_tbl.modify(hot_iter, payer, write_hot);
+        if (was_candidate != is_phishing_state(order.state)) {
+            if (was_candidate)
+                remove_phishing_candidate(order.order_id);
+            else
+                add_phishing_candidate(order.order_id);
+        }
+        return;
+    }
+
+    dmc_orders legacy_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto legacy_iter = legacy_tbl.find(order.order_id);
+    if (legacy_iter != legacy_tbl.end()) {
+        DMC_PROFILE_COUNT(db_writes);
+        legacy_tbl.erase(legacy_iter);
+    }
+    order_colds cold_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_writes);
+    cold_tbl.emplace(payer, [&](auto& c) {
+        c.order_id = order.order_id;
+        c.user = order.user;
+        c.miner = order.miner;
+        c.bill_id = order.bill_id;
+        c.miner_lock_pst = order.miner_lock_pst.quantity.amount;
+        c.price = order.price.quantity.amount;
+        c.epoch = order.epoch;
+    });
+    DMC_PROFILE_COUNT(db_writes);
+    hot_tbl.emplace(payer, write_hot);
+    if (is_phishing_state(order.state)) {
+        add_phishing_candidate(order.order_id);
+    }
+}
+
+void token::erase_order(uint64_t order_id) {
+    order_hots hot_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto hot_iter = hot_tbl.find(order_id);
+    if (hot_iter != hot_tbl.end()) {
+        if (is_phishing_state(hot_iter->state)) {
+            remove_phishing_candidate(order_id);
+        }
+        DMC_PROFILE_COUNT(db_writes);
+        hot_tbl.erase(hot_iter);
+        order_colds cold_tbl(get_self(), get_self().value);
+        DMC_PROFILE_COUNT(db_reads);
+        DMC_PROFILE_COUNT(db_writes);
+        cold_tbl.erase(cold_tbl.get(order_id, "can't find order"));
+        return;
+    }
+    dmc_orders legacy_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    DMC_PROFILE_COUNT(db_writes);
+    legacy_tbl.erase(legacy_tbl.get(order_id, "can't find order"));
+}
+
+bool token::maker_has_orders(name miner) {
+    order_colds cold_tbl(get_self(), get_self().value);
+    auto cold_idx = cold_tbl.get_index<"miner"_n>();
+    if (cold_idx.find(miner.value) != cold_idx.end()) {
+        return true;
+    }
+    dmc_orders legacy_tbl(get_self(), get_self().value);
+    auto legacy_idx = legacy_tbl.get_index<"miner"_n>();
+    return legacy_idx.find(miner.value) != legacy_idx.end();
+}
+
+void token::update_order_asset(dmc_order& order, OrderState new_state, uint64_t claims_interval, uint64_t periods) {
     maker_snapshot_table  maker_snapshot_tbl(get_self(), get_self().value);
     auto iter = maker_snapshot_tbl.find(order.order_id);
     check(iter != maker_snapshot_tbl.end(), "cannot find miner in dmc maker");
@@ -26,13 +158,43 @@ void token::update_order_asset(dmc_order& order, OrderState new_state, uint64_t
     // SEND_INLINE_ACTION(*this, orderassrec, { _self, "active"_n }, { order.order_id, { {miner_rsi_pledge, OrderReceiptReward}, {dmc_pledge, OrderReceiptClaim}}, order.miner, ACC_TYPE_MINER, order.latest_settlement_date});
     // SEND_INLINE_ACTION(*this, orderassrec, { _self, "active"_n }, { order.order_id, { {user_rsi, OrderReceiptReward} }, order.user,  ACC_TYPE_USER, order.latest_settlement_date});
 
-    order.lock_pledge -= dmc_pledge;
-    order.settlement_pledge += dmc_pledge;
-    order.miner_lock_rsi += miner_rsi_total - miner_rsi_pledge;
-    order.miner_rsi += miner_rsi_pledge;
-    order.user_rsi += user_rsi;
+    order.lock_pledge.quantity.amount -= dmc_pledge.quantity.amount * periods;
+    order.settlement_pledge.quantity.amount += dmc_pledge.quantity.amount * periods;
+    order.miner_lock_rsi.quantity.amount += (miner_rsi_total - miner_rsi_pledge).quantity.amount * periods;
+    order.miner_rsi.quantity.amount += miner_rsi_pledge.quantity.amount * periods;
+    order.user_rsi.quantity.amount += user_rsi.quantity.amount * periods;
     order.state = new_state;
-    order.latest_settlement_date += claims_interval;
+    order.latest_settlement_date += claims_interval * periods;
+}
+
+// settle every elapsed Deliver -> PreCont -> Deliver period the user pledge can pay for in one step,
+// so an order left alone for months costs the same as one claimed every period
+void token::catch_up_order(dmc_order& order, const dmc_challenge& challenge, time_point_sec current, uint64_t claims_interval)
+{
+    if (order.state != OrderStateDeliver || order.latest_settlement_date >= current) {
+        return;
+    }
+    if ((!is_challenge_end(challenge.state)) && (challenge.state != ChallengeTimeout)) {
+        return;
+    }
+    if (order.cancel_date != time_point_sec() && order.cancel_date + claims_interval < current) {
+        return;
+    }
+
+    uint64_t periods = (current.sec_since_epoch() - order.latest_settlement_date.sec_since_epoch()) / claims_interval;
+    if (order.price.quantity.amount > 0) {
+        periods = std::min(periods, uint64_t(order.user_pledge.quantity.amount / order.price.quantity.amount));
+    }
+    // a single period is left to change_order
+    if (periods <= 1) {
+        return;
+    }
+
+    extended_asset renew = extended_asset(order.price.quantity.amount * periods, order.price.get_extended_symbol());
+    order.user_pledge -= renew;
+    order.lock_pledge += renew;
+    update_order_asset(order, OrderStateDeliver, claims_interval, periods);
+    EMIT_EVENT(*this, catchuprec, { order.order_id, periods, { {-renew, OrderReceiptRenew} }, order.user, ACC_TYPE_USER, order.latest_settlement_date });
 }
 
 void token::change_order(dmc_order& order, const dmc_challenge& challenge, time_point_sec current, uint64_t claims_interval, name payer)
@@ -61,7 +223,7 @@ void token::change_order(dmc_order& order, const dmc_challenge& challenge, time_
             order.user_pledge -= order.price;
             order.lock_pledge += order.price;
             order.state = OrderStatePreCont;
-            SEND_INLINE_ACTION(*this, orderassrec, { _self, "active"_n }, { order.order_id, { {-order.price, OrderReceiptRenew} }, order.user,  ACC_TYPE_USER, order.latest_settlement_date + per_claims_interval});
+            EMIT_EVENT(*this, orderassrec, { order.order_id, { {-order.price, OrderReceiptRenew} }, order.user,  ACC_TYPE_USER, order.latest_settlement_date + per_claims_interval});
         } else {
             order.state = OrderStatePreEnd;
         }
@@ -83,7 +245,7 @@ void token::change_order(dmc_order& order, const dmc_challenge& challenge, time_
                 rewards.push_back({order.deposit, AssetReceiptDeposit});
             } else {
                 add_balance(order.user, order.deposit, payer);
-                SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n }, { order.order_id, { order.deposit }, order.user, AssetReceiptDeposit});
+                EMIT_EVENT(*this, assetrec, { order.order_id, { order.deposit }, order.user, AssetReceiptDeposit});
             }
         }
         distribute_lp_pool(order.order_id, rewards,extended_asset(0, dmc_sym), payer);
@@ -102,7 +264,7 @@ void token::change_order(dmc_order& order, const dmc_challenge& challenge, time_
                 rewards.push_back({order.deposit, AssetReceiptDeposit});
             } else {
                 add_balance(order.user, order.deposit, payer);
-                SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n }, { order.order_id, { order.deposit }, order.user, AssetReceiptDeposit});
+                EMIT_EVENT(*this, assetrec, { order.order_id, { order.deposit }, order.user, AssetReceiptDeposit});
             }
         }
         distribute_lp_pool(order.order_id, rewards,extended_asset(0, dmc_sym), payer);
@@ -140,13 +302,17 @@ void token::change_order(dmc_order& order, const dmc_challenge& challenge, time_
     }
 }
 
-void token::update_order(dmc_order& order, const dmc_challenge& challenge, name payer)
+void token::update_order(dmc_order& order, const dmc_challenge& challenge, name payer, bool phishing)
 {
-    phishing_challenge();
+    DMC_PROFILE_SCOPE(ScopeUpdateOrder);
+    if (phishing)
+        phishing_challenge();
     auto current_time = time_point_sec(current_time_point());
     uint64_t claims_interval = get_dmc_config("claiminter"_n, default_dmc_claims_interval);
     auto tmp_order = order;
     while (true) {
+        DMC_PROFILE_COUNT(iterations);
+        catch_up_order(order, challenge, current_time, claims_interval);
         change_order(order, challenge, current_time, claims_interval, payer);
         if (tmp_order.state == order.state && tmp_order.latest_settlement_date == order.latest_settlement_date) {
             break;
@@ -155,34 +321,18 @@ void token::update_order(dmc_order& order, const dmc_challenge& challenge, name
     }
 }
 
-void token::generate_maker_snapshot(uint64_t order_id, uint64_t bill_id, name miner, name payer, uint64_t r, bool reset) {
+void token::generate_maker_snapshot(uint64_t order_id, uint64_t bill_id, name miner, name payer, uint64_t r, uint64_t gen) {
     dmc_makers maker_tbl(get_self(), get_self().value);
     auto maker_iter = maker_tbl.find(miner.value);
     check(maker_iter != maker_tbl.end(), "can't find maker pool");
 
-    dmc_maker_pool dmc_pool(get_self(), miner.value);
-    std::vector<maker_lp_pool> lps;
-    std::vector<maker_pool> changed;
-    for (auto iter = dmc_pool.begin(); iter != dmc_pool.end(); iter++) {
-        lps.emplace_back(maker_lp_pool{
-            .owner = iter->owner,
-            .ratio = iter->weight / maker_iter->total_weight,
-        });
-        // if maker pool is empty, set all maker pool weight to 0
-        if (reset) {
-            dmc_pool.modify(iter, payer, [&](auto& m) {
-                m.weight = 0;
-            });
-            changed.push_back(*iter);
-        }
-    }
-
+    // rewards are shared by weight when the order is claimed, no need to copy the pool
     maker_snapshot snapshot_info = {
         .order_id = order_id,
         .miner = maker_iter->miner,
         .bill_id = bill_id,
         .rate = r,
-        .lps = lps
+        .gen = gen,
     };
 
     maker_snapshot_table  maker_snapshot_tbl(get_self(), get_self().value);
@@ -190,32 +340,186 @@ void token::generate_maker_snapshot(uint64_t order_id, uint64_t bill_id, name mi
     maker_snapshot_tbl.emplace(payer, [&](auto& mst) {
         mst = snapshot_info;
     });
-    SEND_INLINE_ACTION(*this, makersnaprec, { _self, "active"_n }, { snapshot_info });
-    if(reset) {
-        SEND_INLINE_ACTION(*this, makerpoolrec, {_self, "active"_n}, {miner, changed});
-    }
+    EMIT_EVENT(*this, makersnaprec, { snapshot_info });
 }
 
 void token::delete_maker_snapshot(uint64_t order_id) {
     maker_snapshot_table  maker_snapshot_tbl(get_self(), get_self().value);
     auto snapshot_iter = maker_snapshot_tbl.find(order_id);
     if (snapshot_iter != maker_snapshot_tbl.end()) {
+        // an order placed before gens existed was never counted as open
+        if (snapshot_iter->gen.has_value()) {
+            maker_reward reward = get_maker_reward(snapshot_iter->miner);
+            reward.open_orders -= std::min<uint64_t>(reward.open_orders, 1);
+            if (reward.young_lps > 0 && snapshot_iter->gen.value() < reward.gen && reward.young_open > 0 && --reward.young_open == 0) {
+                mature_young_weight(reward);
+            }
+            set_maker_reward(reward);
+        }
         maker_snapshot_tbl.erase(snapshot_iter);
     }
 }
 
-extended_asset token::distribute_lp_pool(uint64_t order_id, std::vector<asset_type_args> rewards, extended_asset challenge_pledge, name payer) {
+token::maker_reward token::get_maker_reward(name miner) {
+    maker_rewards reward_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto reward_iter = reward_tbl.find(miner.value);
+    if (reward_iter == reward_tbl.end()) {
+        maker_reward reward;
+        reward.miner = miner;
+        return reward;
+    }
+    return *reward_iter;
+}
+
+void token::set_maker_reward(const maker_reward& reward) {
+    maker_rewards reward_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto reward_iter = reward_tbl.find(reward.miner.value);
+    DMC_PROFILE_COUNT(db_writes);
+    if (reward_iter == reward_tbl.end()) {
+        reward_tbl.emplace(get_self(), [&](auto& r) {
+            r = reward;
+        });
+    } else {
+        reward_tbl.modify(reward_iter, get_self(), [&](auto& r) {
+            r = reward;
+        });
+    }
+}
+
+// pays what `owner` earned with `weight` since it last touched its position and adds `change` to it,
+// returns the part of `weight` still worth something
+double token::settle_lp_reward(maker_reward& reward, name owner, double weight, double change, name payer) {
+    lp_rewards lp_tbl(get_self(), reward.miner.value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto lp_iter = lp_tbl.find(owner.value);
+    lp_reward lp;
+    if (lp_iter == lp_tbl.end()) {
+        lp.owner = owner;
+        lp.reward_debt = 0;
+        lp.epoch = 0;
+    } else {
+        lp = *lp_iter;
+    }
+
+    bool current = lp.epoch == reward.epoch;
+    bool paid = current || lp.epoch + 1 == reward.epoch;
+    double index = current ? reward.reward_per_weight : reward.closed_per_weight;
+    double earned = 0;
+    if (paid)
+        earned = std::max(weight - lp.young, 0.0) * (index - lp.reward_debt);
+    if (lp.young > 0) {
+        reward_matures mature_tbl(get_self(), reward.miner.value);
+        DMC_PROFILE_COUNT(db_reads);
+        auto mature_iter = mature_tbl.lower_bound(lp.young_gen);
+        if (mature_iter == mature_tbl.end()) {
+            // still waiting for the orders placed before it joined
+            earned += lp.young * (reward.young_per_weight - lp.young_debt);
+            lp.young_debt = reward.young_per_weight;
+        } else {
+            // the young part earned for the orders of its gen until it matured and like any weight since
+            if (paid)
+                earned += lp.young * (mature_iter->young_per_weight - lp.young_debt + index - mature_iter->reward_per_weight);
+            lp.young = 0;
+            DMC_PROFILE_COUNT(db_writes);
+            if (mature_iter->lps <= 1) {
+                mature_tbl.erase(mature_iter);
+            } else {
+                mature_tbl.modify(mature_iter, get_self(), [&](auto& m) {
+                    m.lps--;
+                });
+            }
+        }
+    }
+    int64_t pending = std::min(int64_t(std::floor(earned)), reward.unsettled);
+    if (pending > 0) {
+        reward.unsettled -= pending;
+        extended_asset quantity = extended_asset(pending, dmc_sym);
+        add_balance(owner, quantity, payer);
+        EMIT_EVENT(*this, lprewardrec, {owner, reward.miner, quantity});
+    }
+
+    if (change < 0 && lp.young > 0) {
+        // a redemption takes the young part first
+        double removed = std::min(lp.young, -change);
+        lp.young -= removed;
+        reward.young_weight = std::max(reward.young_weight - removed, 0.0);
+        if (lp.young <= 0) {
+            lp.young = 0;
+            if (--reward.young_lps == 0) {
+                reward.young_open = 0;
+                reward.young_weight = 0;
+            }
+        }
+    } else if (change > 0 && reward.open_orders > 0) {
+        // the orders open now are all older than the new gen, the young weight waits for every one of them
+        reward.gen++;
+        reward.young_open = reward.open_orders;
+        if (lp.young == 0)
+            reward.young_lps++;
+        reward.young_weight += change;
+        lp.young += change;
+        lp.young_gen = reward.gen;
+        lp.young_debt = reward.young_per_weight;
+    }
+
+    lp.reward_debt = reward.reward_per_weight;
+    lp.epoch = reward.epoch;
+    DMC_PROFILE_COUNT(db_writes);
+    if (lp_iter == lp_tbl.end()) {
+        lp_tbl.emplace(payer, [&](auto& l) {
+            l = lp;
+        });
+    } else {
+        lp_tbl.modify(lp_iter, payer, [&](auto& l) {
+            l = lp;
+        });
+    }
+    return current ? weight : 0;
+}
+
+// the young weight is now like any other, its lps settle the indexes of this moment through the row
+void token::mature_young_weight(maker_reward& reward) {
+    reward_matures mature_tbl(get_self(), reward.miner.value);
+    DMC_PROFILE_COUNT(db_writes);
+    mature_tbl.emplace(get_self(), [&](auto& m) {
+        m.gen = reward.gen;
+        m.young_per_weight = reward.young_per_weight;
+        m.reward_per_weight = reward.reward_per_weight;
+        m.lps = reward.young_lps;
+    });
+    reward.young_lps = 0;
+    reward.young_open = 0;
+    reward.young_weight = 0;
+}
+
+void token::erase_lp_reward(name miner, name owner) {
+    lp_rewards lp_tbl(get_self(), miner.value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto lp_iter = lp_tbl.find(owner.value);
+    if (lp_iter != lp_tbl.end()) {
+        DMC_PROFILE_COUNT(db_writes);
+        lp_tbl.erase(lp_iter);
+    }
+}
+
+extended_asset token::distribute_lp_pool(uint64_t order_id, std::vector<asset_type_args> rewards, extended_asset challenge_pledge, name payer, std::map<name, int64_t>* credits) {
+    DMC_PROFILE_SCOPE(ScopeDistributeLpPool);
     maker_snapshot_table  maker_snapshot_tbl(get_self(), get_self().value);
+    DMC_PROFILE_COUNT(db_reads);
     auto snapshot_iter = maker_snapshot_tbl.find(order_id);
     check(snapshot_iter != maker_snapshot_tbl.end(), "order snapshot not exists");
     check(rewards.size(), "invalid rewards size");
     
     dmc_makers maker_tbl(get_self(), get_self().value);
     auto miner = snapshot_iter->miner;
+    DMC_PROFILE_COUNT(db_reads);
     auto maker_iter = maker_tbl.find(miner.value);
-    auto remain_pay = extended_asset(0, rewards[0].quant.get_extended_symbol());
+    check(maker_iter != maker_tbl.end(), "can't find maker pool");
     std::vector<asset_type_args> miner_receipt;
     for (uint64_t i = 0; i < rewards.size(); i++) {
+        DMC_PROFILE_COUNT(iterations);
         if (rewards[i].type == AssetReceiptClaim || rewards[i].type == AssetReceiptDeposit || rewards[i].type == AssetReceiptReward) {
             double current_r = snapshot_iter->rate / 100.0;
             auto miner_dmc_pledge = extended_asset(round(rewards[i].quant.quantity.amount / (current_r + 1.0)), rewards[i].quant.get_extended_symbol());
@@ -224,9 +528,12 @@ extended_asset token::distribute_lp_pool(uint64_t order_id, std::vector<asset_ty
             auto challenge_pay = miner_dmc_pledge.quantity > challenge_pledge.quantity ? challenge_pledge : miner_dmc_pledge;
             miner_dmc_pledge -= challenge_pay;
             if (miner_dmc_pledge.quantity.amount) {
-                add_balance(miner, miner_dmc_pledge, payer);
+                if (credits)
+                    (*credits)[miner] += miner_dmc_pledge.quantity.amount;
+                else
+                    add_balance(miner, miner_dmc_pledge, payer);
                 miner_receipt.push_back({miner_dmc_pledge, rewards[i].type});
-                SEND_INLINE_ACTION(*this, assetrec, {_self, "active"_n}, {order_id, {miner_dmc_pledge}, miner, rewards[i].type});
+                EMIT_EVENT(*this, assetrec, {order_id, {miner_dmc_pledge}, miner, rewards[i].type});
             }
             if (challenge_pay.quantity.amount > 0) {
                 miner_receipt.push_back({-challenge_pay, OrderReceiptChallengeAns});
@@ -236,236 +543,246 @@ extended_asset token::distribute_lp_pool(uint64_t order_id, std::vector<asset_ty
         }
     }
     if (miner_receipt.size() > 0) {
-        SEND_INLINE_ACTION(*this, orderassrec, {_self, "active"_n}, {order_id, miner_receipt, miner, ACC_TYPE_MINER, time_point_sec(current_time_point())});
+        EMIT_EVENT(*this, orderassrec, {order_id, miner_receipt, miner, ACC_TYPE_MINER, time_point_sec(current_time_point())});
     }
-    extended_asset pledge = extended_asset(0, rewards[0].quant.get_extended_symbol());
+    // the returned lock was already counted in the value of a weight, the rest is a reward of the weights held
+    // since the order was placed
+    auto returned = extended_asset(0, rewards[0].quant.get_extended_symbol());
+    auto reward_pledge = extended_asset(0, rewards[0].quant.get_extended_symbol());
     for (uint64_t i = 0; i < rewards.size(); i++) {
-        pledge += rewards[i].quant;
+        if (rewards[i].type == AssetReceiptMinerLock)
+            returned += rewards[i].quant;
+        else
+            reward_pledge += rewards[i].quant;
     }
 
-    auto sub_pledge = extended_asset(0, pledge.get_extended_symbol());
-    std::vector<maker_pool> pool_info;
-    std::vector<distribute_maker_snapshot> distribute_info;
-    dmc_maker_pool dmc_pool(get_self(), miner.value);
-    auto total_add = extended_asset(0, pledge.get_extended_symbol());
-
-    auto iter_end = snapshot_iter->lps.end();
-    for (auto iter = snapshot_iter->lps.begin();  iter != iter_end; iter++) {
-        if (iter->owner == miner) {
-            continue;
-        }
-        auto owner_pledge = extended_asset(std::floor(iter->ratio * pledge.quantity.amount), pledge.get_extended_symbol());
-        auto pool_iter = dmc_pool.find(iter->owner.value);
-        if (pool_iter != dmc_pool.end()) {
-            double owner_weight = (double)owner_pledge.quantity.amount / maker_iter->total_staked.quantity.amount * maker_iter->total_weight;
-            dmc_pool.modify(pool_iter, payer, [&](auto& p) {
-                p.weight = p.weight + owner_weight;
-            });
-            pool_info.emplace_back(*pool_iter);
-            distribute_info.push_back({iter->owner, owner_pledge, MakerDistributePool});
-        } else {
-            add_balance(iter->owner, owner_pledge, payer);
-            sub_pledge += owner_pledge;
-            distribute_info.push_back({iter->owner, owner_pledge, MakerDistributeAccount});
-        }
-        total_add += owner_pledge;
-    }
-    auto owner_pledge = pledge - total_add;
-    auto pool_iter = dmc_pool.find(miner.value);
-    if (pool_iter != dmc_pool.end()) {
-        double owner_weight = (double)owner_pledge.quantity.amount / maker_iter->total_staked.quantity.amount * maker_iter->total_weight;
-        dmc_pool.modify(pool_iter, payer, [&](auto& p) {
-            p.weight = p.weight + owner_weight;
-        });
-        pool_info.emplace_back(*pool_iter);
-        distribute_info.push_back({miner, owner_pledge, MakerDistributePool});
+    maker_reward reward = get_maker_reward(miner);
+    // a lock taken before `locked` existed was never counted
+    reward.locked -= std::min(reward.locked, returned.quantity.amount);
+    // the young weight joined after an order of an older gen was placed, it gets nothing of it
+    bool young_shares = reward.young_lps > 0 && snapshot_iter->gen.has_value() && snapshot_iter->gen.value() >= reward.gen;
+    double weight = maker_iter->total_weight - (reward.young_lps > 0 && !young_shares ? reward.young_weight : 0);
+    // the rounding left of a weight made only of young weight must not take the whole reward
+    bool indexed = weight > maker_iter->total_weight * 1e-6;
+    if (indexed) {
+        double per_weight = (double)reward_pledge.quantity.amount / weight;
+        reward.reward_per_weight += per_weight;
+        if (young_shares)
+            reward.young_per_weight += per_weight;
+        reward.unsettled += reward_pledge.quantity.amount;
     } else {
-        add_balance(miner, owner_pledge, payer);
-        sub_pledge += owner_pledge;
-        distribute_info.push_back({miner, owner_pledge, MakerDistributeAccount});
+        returned += reward_pledge;
     }
+    set_maker_reward(reward);
 
-    extended_asset new_total = maker_iter->total_staked + (pledge - sub_pledge);
-    double weight_change = (double)(pledge - sub_pledge).quantity.amount / maker_iter->total_staked.quantity.amount * maker_iter->total_weight;
+    auto sub_pledge = extended_asset(0, rewards[0].quant.get_extended_symbol());
+    std::vector<distribute_maker_snapshot> distribute_info;
+    extended_asset new_total = maker_iter->total_staked + returned;
     double r = cal_current_rate(new_total, miner, maker_iter->get_real_m());
+    DMC_PROFILE_COUNT(db_writes);
     maker_tbl.modify(maker_iter, get_self(), [&](auto& m) {
-        m.total_weight = m.total_weight + weight_change;
         m.total_staked = new_total;
         m.current_rate = r;
     });
-
-    SEND_INLINE_ACTION(*this, makerecord, { _self, "active"_n }, { *maker_iter });
-    SEND_INLINE_ACTION(*this, makerpoolrec, { _self, "active"_n }, { miner, pool_info });
-    SEND_INLINE_ACTION(*this, dismakerec, { _self, "active"_n }, { order_id, rewards, sub_pledge, distribute_info });
-    return remain_pay;
+    if (returned.quantity.amount > 0)
+        distribute_info.push_back({miner, returned, MakerDistributePool});
+    if (indexed && reward_pledge.quantity.amount > 0)
+        distribute_info.push_back({miner, reward_pledge, MakerDistributeIndex});
+
+    EMIT_EVENT(*this, makerecord, { *maker_iter });
+    EMIT_EVENT(*this, dismakerec, { order_id, rewards, sub_pledge, distribute_info });
+    // the part of the challenge pledge the miner share of this distribution could not cover
+    return challenge_pledge;
 }
 
 void token::updateorder(name payer, uint64_t order_id)
 {
     require_auth(payer);
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
+    auto order_info = get_order(order_id);
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
     check(challenge_iter != challenge_tbl.end(), "can't find challenge");
 
-    auto order_info = *order_iter;
     update_order(order_info, *challenge_iter, payer);
 
-    order_tbl.modify(order_iter, payer, [&](auto& o) {
-        o = order_info;
-    });
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { *order_iter, 2 });
+    store_order(order_info, payer);
+    EMIT_EVENT(*this, orderrec, { order_info, 2 });
 }
 
 void token::claimdeposit(name payer, uint64_t order_id) {
     require_auth(payer);
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
+    auto order_info = get_order(order_id);
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
     check(challenge_iter != challenge_tbl.end(), "can't find challenge");
-    check(order_iter->deposit.quantity.amount > 0, "no deposit to claim");
+    check(order_info.deposit.quantity.amount > 0, "no deposit to claim");
 
-    auto order_info = *order_iter;
     update_order(order_info, *challenge_iter, payer);
 
-    check(payer == order_iter->user, "only order user can claim deposit");
+    check(payer == order_info.user, "only order user can claim deposit");
     check(order_info.deposit_valid <= order_info.latest_settlement_date, "order not reach end, can not deposit");
     add_balance(order_info.user, order_info.deposit, payer);
-    SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n }, { order_id, { order_info.deposit }, order_info.user, AssetReceiptDeposit});
+    EMIT_EVENT(*this, assetrec, { order_id, { order_info.deposit }, order_info.user, AssetReceiptDeposit});
     order_info.deposit = extended_asset(0, order_info.deposit.get_extended_symbol());
-    order_tbl.modify(order_iter, payer, [&](auto& o) {
-        o = order_info;
-    });
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { order_info, 2 });
+    store_order(order_info, payer);
+    EMIT_EVENT(*this, orderrec, { order_info, 2 });
 }
 
 void token::claimorder(name payer, uint64_t order_id)
 {
     require_auth(payer);
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
+    claim_orders(payer, {order_id});
+}
+
+void token::claimorders(name payer, std::vector<uint64_t> order_ids)
+{
+    require_auth(payer);
+    claim_orders(payer, std::move(order_ids));
+}
+
+void token::claim_orders(name payer, std::vector<uint64_t> order_ids)
+{
+    check(order_ids.size() > 0 && order_ids.size() <= max_claim_orders, "invalid order count");
+    std::sort(order_ids.begin(), order_ids.end());
+    check(std::adjacent_find(order_ids.begin(), order_ids.end()) == order_ids.end(), "duplicate order id");
+
+    phishing_challenge();
     dmc_challenges challenge_tbl(get_self(), get_self().value);
-    auto challenge_iter = challenge_tbl.find(order_id);
-    check(challenge_iter != challenge_tbl.end(), "can't find challenge");
+    std::vector<dmc_order> orders;
+    std::vector<dmc_challenge> challenges;
+    orders.reserve(order_ids.size());
+    challenges.reserve(order_ids.size());
+    int64_t total_rsi = 0;
+    for (uint64_t order_id : order_ids) {
+        auto order_info = get_order(order_id);
+        auto challenge_iter = challenge_tbl.find(order_id);
+        check(challenge_iter != challenge_tbl.end(), "can't find challenge");
+
+        update_order(order_info, *challenge_iter, payer, false);
+        check(order_info.settlement_pledge.quantity.amount > 0, "no settlement pledge to claim");
+        total_rsi += order_info.user_rsi.quantity.amount + order_info.miner_rsi.quantity.amount;
+        orders.push_back(order_info);
+        challenges.push_back(*challenge_iter);
+    }
 
-    auto order_info = *order_iter;
-    update_order(order_info, *challenge_iter, payer);
-    check(order_info.settlement_pledge.quantity.amount > 0, "no settlement pledge to claim");
+    // the rsi of every order goes through one allocation and one swap, the dmc is shared back by rsi,
+    // the last share takes the rounding dust
+    int64_t dmc_left = get_dmc_by_vrsi(extended_asset(total_rsi, rsi_sym)).quantity.amount;
+    int64_t rsi_left = total_rsi;
+    auto share_dmc = [&](int64_t rsi) {
+        int64_t dmc = rsi_left == 0 ? 0 : fixed::narrow((fixed::uint128)dmc_left * rsi / rsi_left);
+        rsi_left -= rsi;
+        dmc_left -= dmc;
+        return extended_asset(dmc, dmc_sym);
+    };
 
-    auto user_dmc = get_dmc_by_vrsi(order_info.user_rsi);
-    add_balance(order_info.user, user_dmc, payer);
-    auto challenge = *challenge_iter;
-    auto miner_remain_pay = distribute_lp_pool(order_info.order_id, {{order_info.settlement_pledge, AssetReceiptClaim}, {get_dmc_by_vrsi(order_info.miner_rsi), AssetReceiptReward}}, challenge.miner_pay, payer);
-    challenge.miner_pay = miner_remain_pay;
+    // balances are credited once per account after every order is settled
+    std::map<name, int64_t> credits;
+    for (size_t i = 0; i < orders.size(); i++) {
+        auto& order_info = orders[i];
+        auto& challenge = challenges[i];
+        uint64_t order_id = order_info.order_id;
+
+        auto user_dmc = share_dmc(order_info.user_rsi.quantity.amount);
+        auto miner_dmc = share_dmc(order_info.miner_rsi.quantity.amount);
+        credits[order_info.user] += user_dmc.quantity.amount;
+        challenge.miner_pay = distribute_lp_pool(order_id, {{order_info.settlement_pledge, AssetReceiptClaim}, {miner_dmc, AssetReceiptReward}}, challenge.miner_pay, payer, &credits);
+
+        order_info.user_rsi = extended_asset(0, order_info.user_rsi.get_extended_symbol());
+        order_info.settlement_pledge = extended_asset(0, order_info.settlement_pledge.get_extended_symbol());
+        order_info.miner_rsi = extended_asset(0, order_info.miner_rsi.get_extended_symbol());
+
+        if (order_info.deposit_valid <= order_info.latest_settlement_date && order_info.deposit.quantity.amount > 0) {
+            credits[order_info.user] += order_info.deposit.quantity.amount;
+            EMIT_EVENT(*this, assetrec, { order_id, { order_info.deposit }, order_info.user, AssetReceiptDeposit});
+            order_info.deposit = extended_asset(0, order_info.deposit.get_extended_symbol());
+        }
 
-    order_info.user_rsi = extended_asset(0, order_info.user_rsi.get_extended_symbol());
-    order_info.settlement_pledge = extended_asset(0, order_info.settlement_pledge.get_extended_symbol());
-    order_info.miner_rsi = extended_asset(0, order_info.miner_rsi.get_extended_symbol());
+        bool deleted = false;
+        if ((order_info.state == OrderStateEnd || order_info.state == OrderStateCancel) &&
+            (!order_info.lock_pledge.quantity.amount) && (!order_info.miner_lock_rsi.quantity.amount) &&
+            (!order_info.deposit.quantity.amount) && (!order_info.miner_lock_dmc.quantity.amount)) {
+                if (order_info.user_pledge.quantity.amount) {
+                    credits[order_info.user] += order_info.user_pledge.quantity.amount;
+                    EMIT_EVENT(*this, assetrec, { order_id, { order_info.user_pledge }, order_info.user, AssetReceiptSubReserve});
+                    order_info.user_pledge = extended_asset(0, order_info.user_pledge.get_extended_symbol());
+                }
+                deleted = true;
+        }
 
-    if (order_info.deposit_valid <= order_info.latest_settlement_date && order_info.deposit.quantity.amount > 0) {
-        add_balance(order_info.user, order_info.deposit, payer);
-        SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n }, { order_id, { order_info.deposit }, order_info.user, AssetReceiptDeposit});
-        order_info.deposit = extended_asset(0, order_info.deposit.get_extended_symbol());
-    }
+        auto challenge_iter = challenge_tbl.find(order_id);
+        if (deleted) {
+            erase_order(order_id);
+            challenge_tbl.erase(challenge_iter);
+            delete_maker_snapshot(order_id);
+        } else {
+            store_order(order_info, payer);
+            challenge_tbl.modify(challenge_iter, payer, [&](auto& c) {
+                c = challenge;
+            });
+        }
 
-    
-    bool deleted = false;
-    if ((order_info.state == OrderStateEnd || order_info.state == OrderStateCancel) &&
-        (!order_info.lock_pledge.quantity.amount) && (!order_info.miner_lock_rsi.quantity.amount) &&
-        (!order_info.deposit.quantity.amount) && (!order_info.miner_lock_dmc.quantity.amount)) {
-            if (order_info.user_pledge.quantity.amount) {
-                add_balance(order_info.user, order_info.user_pledge, payer);
-                SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n }, { order_id, { order_info.user_pledge }, order_info.user, AssetReceiptSubReserve});
-                order_info.user_pledge = extended_asset(0, order_info.user_pledge.get_extended_symbol());
-            }
-            deleted = true;
+        EMIT_EVENT(*this, orderrec, { order_info, 2 });
+        EMIT_EVENT(*this, challengerec, { challenge });
+        EMIT_EVENT(*this, assetrec, { order_id, { user_dmc }, order_info.user, AssetReceiptClaim});
     }
 
-    if (deleted) {
-        order_tbl.erase(order_iter);
-        challenge_tbl.erase(challenge_iter);
-        delete_maker_snapshot(order_id);
-    } else {
-        order_tbl.modify(order_iter, payer, [&](auto& o) {
-            o = order_info;
-        });
-        challenge_tbl.modify(challenge_iter, payer, [&](auto& c) {
-            c = challenge;
-        });
+    for (const auto& credit : credits) {
+        if (credit.second > 0) {
+            add_balance(credit.first, extended_asset(credit.second, dmc_sym), payer);
+        }
     }
-
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { order_info, 2 });
-    SEND_INLINE_ACTION(*this, challengerec, { _self, "active"_n }, { challenge });
-    SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n }, { order_id, { user_dmc }, order_info.user, AssetReceiptClaim});
 }
 
 void token::addordasset(name sender, uint64_t order_id, extended_asset quantity)
 {
     require_auth(sender);
 
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
-    check(order_iter->user == sender, "only user can add order asset");
+    auto order_info = get_order(order_id);
+    check(order_info.user == sender, "only user can add order asset");
 
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
     check(challenge_iter != challenge_tbl.end(), "can't find challenge");
 
-    auto order_info = *order_iter;
     update_order(order_info, *challenge_iter, sender);
 
     sub_balance(sender, quantity);
     order_info.user_pledge += quantity;
 
-    order_tbl.modify(order_iter, sender, [&](auto& o) {
-        o = order_info;
-    });
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { *order_iter, 2 });
+    store_order(order_info, sender);
+    EMIT_EVENT(*this, orderrec, { order_info, 2 });
 }
 
 void token::subordasset(name sender, uint64_t order_id, extended_asset quantity)
 {
     require_auth(sender);
 
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
-    check(order_iter->user == sender, "only user can sub order asset");
+    auto order_info = get_order(order_id);
+    check(order_info.user == sender, "only user can sub order asset");
 
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
     check(challenge_iter != challenge_tbl.end(), "can't find challenge");
 
-    auto order_info = *order_iter;
     update_order(order_info, *challenge_iter, sender);
 
     check(order_info.user_pledge >= quantity, "not enough user pledge");
     add_balance(sender, quantity, sender);
     order_info.user_pledge -= quantity;
 
-    order_tbl.modify(order_iter, sender, [&](auto& o) {
-        o = order_info;
-    });
+    store_order(order_info, sender);
 
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { *order_iter, 2 });
+    EMIT_EVENT(*this, orderrec, { order_info, 2 });
 }
 
 void token::cancelorder(name sender, uint64_t order_id) {
     require_auth(sender);
-    dmc_orders order_tbl(get_self(), get_self().value);
-    auto order_iter = order_tbl.find(order_id);
-    check(order_iter != order_tbl.end(), "can't find order");
+    auto order_info = get_order(order_id);
     dmc_challenges challenge_tbl(get_self(), get_self().value);
     auto challenge_iter = challenge_tbl.find(order_id);
     check(challenge_iter != challenge_tbl.end(), "can't find challenge");
 
-    auto order_info = *order_iter;
     auto challenge_info = *challenge_iter;
     update_order(order_info, challenge_info, sender);
     check(is_challenge_end(challenge_info.state) || challenge_info.state == ChallengePrepare, "invalid challenge state");
@@ -478,8 +795,7 @@ void token::cancelorder(name sender, uint64_t order_id) {
         distribute_lp_pool(order_info.order_id, {{order_info.miner_lock_dmc, AssetReceiptMinerLock}}, extended_asset(0, dmc_sym), get_self());
         delete_order_pst(order_info);
         add_balance(order_info.user, order_info.lock_pledge + order_info.user_pledge + order_info.deposit, sender);
-        SEND_INLINE_ACTION(*this, assetrec, { _self, "active"_n },
-        { order_id, { order_info.lock_pledge, order_info.user_pledge, order_info.deposit }, order_info.user, AssetReceiptCancel});
+        EMIT_EVENT(*this, assetrec, { order_id, { order_info.lock_pledge, order_info.user_pledge, order_info.deposit }, order_info.user, AssetReceiptCancel});
         order_info.miner_lock_dmc = extended_asset(0, order_info.miner_lock_dmc.get_extended_symbol());
         order_info.lock_pledge = extended_asset(0, order_info.lock_pledge.get_extended_symbol());
         order_info.user_pledge = extended_asset(0, order_info.user_pledge.get_extended_symbol());
@@ -494,19 +810,17 @@ void token::cancelorder(name sender, uint64_t order_id) {
     }
     
     if (deleted) {
-        order_tbl.erase(order_iter);
+        erase_order(order_id);
         challenge_tbl.erase(challenge_iter);
         delete_maker_snapshot(order_id);
     } else {
-        order_tbl.modify(order_iter, sender, [&](auto& o) {
-            o = order_info;
-        });
+        store_order(order_info, sender);
         challenge_tbl.modify(challenge_iter, sender, [&](auto& c) {
             c = challenge_info;
         });
     }
-    SEND_INLINE_ACTION(*this, orderrec, { _self, "active"_n }, { order_info, 2 });
-    SEND_INLINE_ACTION(*this, challengerec, { _self, "active"_n }, { challenge_info });
+    EMIT_EVENT(*this, orderrec, { order_info, 2 });
+    EMIT_EVENT(*this, challengerec, { challenge_info });
 }
 
 }
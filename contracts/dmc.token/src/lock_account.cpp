@@ -69,7 +69,8 @@ void token::exunlock(name owner, extended_asset quantity, time_point_sec expirat
     stats statstable(_self, quantity.contract.value);
     const auto& st = statstable.get(quantity.quantity.symbol.code().raw(), "token with symbol does not exist");
 
-    lock_sub_balance(owner, quantity, expiration);
+    time_point_sec lock_timestamp = lock_sub_balance(owner, quantity, expiration);
+    check(time_point_sec(current_time_point()) >= lock_timestamp, "under expiration time");
     add_balance(owner, quantity, owner);
 
     statstable.modify(st, get_self(), [&](auto& s) {
@@ -78,16 +79,55 @@ void token::exunlock(name owner, extended_asset quantity, time_point_sec expirat
     });
 }
 
-void token::lock_sub_balance(name owner, extended_asset value, time_point_sec expiration)
+void token::exunlockall(name owner, extended_symbol sym, string memo)
 {
+    require_auth(owner);
+
+    check(sym.get_symbol().is_valid(), "invalid symbol name");
+    check(memo.size() <= 256, "memo has more than 256 bytes");
+
+    require_recipient(sym.get_contract());
+
+    stats statstable(_self, sym.get_contract().value);
+    const auto& st = statstable.get(sym.get_symbol().code().raw(), "token with symbol does not exist");
+
+    // rows of a symbol are ordered by lock time, only the expired ones are visited
+    time_point_sec now_time = time_point_sec(current_time_point());
     lock_accounts from_acnts(_self, owner.value);
     auto from_iter = from_acnts.get_index<"byextendedas"_n>();
-    auto from = from_iter.find(lock_account::key(value.get_extended_symbol(), expiration));
+    auto from = from_iter.lower_bound(lock_account::key(sym, time_point_sec()));
+
+    extended_asset quantity(0, sym);
+    while (from != from_iter.end() && from->balance.get_extended_symbol() == sym && from->lock_timestamp <= now_time) {
+        quantity += from->balance;
+        from = from_iter.erase(from);
+    }
+    check(quantity.quantity.amount > 0, "no expired lock tokens");
+
+    change_lock_summary(owner, -quantity, owner);
+    add_balance(owner, quantity, owner);
+
+    statstable.modify(st, get_self(), [&](auto& s) {
+        s.reserve_supply -= quantity.quantity;
+        s.supply += quantity.quantity;
+    });
+}
+
+// subtracts from the bucket of expiration, or from a row stored at the exact time before buckets,
+// returns the lock time of the row
+time_point_sec token::lock_sub_balance(name owner, extended_asset value, time_point_sec expiration)
+{
+    lock_accounts from_acnts(_self, owner.value);
+    auto from_iter = from_acnts.get_index<"byextendedas"_n>();
+    auto from = from_iter.find(lock_account::key(value.get_extended_symbol(), lock_account::bucket(expiration)));
+    if (from == from_iter.end())
+        from = from_iter.find(lock_account::key(value.get_extended_symbol(), expiration));
 
     check(from != from_iter.end(), "no such lock tokens");
     check(from->balance.quantity.amount >= value.quantity.amount, "overdrawn balance when sub lock balance");
     check(from->balance.get_extended_symbol() == value.get_extended_symbol(), "symbol precision mismatch");
 
+    time_point_sec lock_timestamp = from->lock_timestamp;
     if (from->balance.quantity.amount == value.quantity.amount) {
         from_iter.erase(from);
     } else {
@@ -95,10 +135,13 @@ void token::lock_sub_balance(name owner, extended_asset value, time_point_sec ex
             a.balance -= value;
         });
     }
+    change_lock_summary(owner, -value, get_self());
+    return lock_timestamp;
 }
 
 void token::lock_add_balance(name owner, extended_asset value, time_point_sec expiration, name ram_payer)
 {
+    expiration = lock_account::bucket(expiration);
     lock_accounts to_acnts(_self, owner.value);
     auto to_iter = to_acnts.get_index<"byextendedas"_n>();
     auto to = to_iter.find(lock_account::key(value.get_extended_symbol(), expiration));
@@ -114,6 +157,7 @@ void token::lock_add_balance(name owner, extended_asset value, time_point_sec ex
             a.balance += value;
         });
     }
+    change_lock_summary(owner, value, ram_payer);
 }
 
 void token::lock_sub_balance(name foundation, extended_asset quantity, bool recur)
@@ -123,9 +167,10 @@ void token::lock_sub_balance(name foundation, extended_asset quantity, bool recu
     auto from_iter = from_acnts.get_index<"byextendedas"_n>();
     auto from = from_iter.lower_bound(lock_account::key(quantity.get_extended_symbol(), time_point_sec()));
 
-    check(quantity.get_extended_symbol() == from->balance.get_extended_symbol(), "symbol precision mismatch");
+    extended_asset total = quantity;
     while (quantity.quantity.amount > 0) {
         check(from != from_iter.end(), "overdrawn balance when lock_sub");
+        check(quantity.get_extended_symbol() == from->balance.get_extended_symbol(), "symbol precision mismatch");
 
         if (recur)
             check(time_point_sec(current_time_point()) >= from->lock_timestamp, "under expiration time");
@@ -139,6 +184,45 @@ void token::lock_sub_balance(name foundation, extended_asset quantity, bool recu
             });
         }
     }
+    change_lock_summary(foundation, -total, get_self());
+}
+
+/**
+ * applies a change to the summary after lockaccounts has been changed. A summary missing
+ * for rows stored before summaries existed is built from the symbol's rows once.
+ */
+void token::change_lock_summary(name owner, extended_asset value, name ram_payer)
+{
+    auto sym = value.get_extended_symbol();
+    lock_accounts lock_acnts(_self, owner.value);
+    auto lock_idx = lock_acnts.get_index<"byextendedas"_n>();
+    auto first = lock_idx.lower_bound(lock_account::key(sym, time_point_sec()));
+    bool empty = first == lock_idx.end() || first->balance.get_extended_symbol() != sym;
+
+    lock_summaries summary_tbl(_self, owner.value);
+    auto summary_idx = summary_tbl.get_index<"byextendedas"_n>();
+    auto summary = summary_idx.find(account::key(sym));
+    if (summary == summary_idx.end()) {
+        if (empty)
+            return;
+        extended_asset total(0, sym);
+        for (auto it = first; it != lock_idx.end() && it->balance.get_extended_symbol() == sym; it++) {
+            total += it->balance;
+        }
+        summary_tbl.emplace(ram_payer, [&](auto& s) {
+            s.primary = summary_tbl.available_primary_key();
+            s.balance = total;
+            s.earliest_unlock = first->lock_timestamp;
+        });
+    } else if (empty) {
+        summary_idx.erase(summary);
+    } else {
+        summary_idx.modify(summary, get_self(), [&](auto& s) {
+            s.balance += value;
+            s.earliest_unlock = first->lock_timestamp;
+        });
+        check(summary->balance.quantity.amount > 0, "overdrawn balance when change lock summary");
+    }
 }
 
 void token::exchange_balance_to_lockbalance(name owner, extended_asset value, time_point_sec lock_timestamp, name ram_payer)
@@ -159,12 +243,10 @@ void token::exchange_balance_to_lockbalance(name owner, extended_asset value, ti
 
 extended_asset token::get_balance(extended_asset quantity, name name)
 {
-    accounts acnts(_self, name.value);
-
-    auto iter = acnts.get_index<"byextendedas"_n>();
-    auto it = iter.find(account::key(quantity.get_extended_symbol()));
+    accounts_v2 acnts(_self, name.value);
+    auto it = find_account(acnts, name, quantity.get_extended_symbol());
 
-    if (it == iter.end())
+    if (it == acnts.end())
         return extended_asset(0, quantity.get_extended_symbol());
 
     check(it->balance.quantity.symbol == quantity.quantity.symbol, "symbol precision mismatch");
@@ -1,4 +1,5 @@
 #include <dmc.token/dmc.token.hpp>
+#include <algorithm>
 
 namespace eosio {
 
@@ -14,30 +15,103 @@ void token::nftcreatesym(extended_symbol nft_symbol, std::string symbol_uri, nft
     check(symbol_iter == symbol_idx.end(), "symbol already exists");
 
     auto symbol_id = nft_symbol_tbl.available_primary_key();
+    check(symbol_id <= max_nft_symbol_id, "too many nft symbols");
     nft_symbol_tbl.emplace(nft_symbol.get_contract(), [&](auto& n) {
         n.symbol_id = symbol_id;
         n.nft_symbol = nft_symbol;
         n.symbol_uri = symbol_uri;
         n.type = type;
     });
-    SEND_INLINE_ACTION(*this, nftsymrec, { get_self(), "active"_n }, { symbol_id, nft_symbol, symbol_uri, type });
+    EMIT_EVENT(*this, nftsymrec, { symbol_id, nft_symbol, symbol_uri, type });
 }
 
-void token::nftcreate(name to, std::string nft_uri, std::string nft_name, std::string extra_data, extended_asset quantity)
+token::nft_symbol_info token::get_nft_symbol(const extended_symbol& nft_symbol)
 {
-    require_auth(quantity.contract);
-    check(is_account(to), "to account no exists!");
     nft_symbols nft_symbol_tbl(get_self(), get_self().value);
     auto symbol_idx = nft_symbol_tbl.get_index<"extsymbol"_n>();
-    auto symbol_iter = symbol_idx.find(nft_symbol_info::get_extended_symbol(quantity.get_extended_symbol()));
+    auto symbol_iter = symbol_idx.find(nft_symbol_info::get_extended_symbol(nft_symbol));
     check(symbol_iter != symbol_idx.end(), "symbol not exists");
+    return *symbol_iter;
+}
+
+// returns the new balance, an emptied holding is erased
+int64_t token::change_nft_holding(name owner, uint64_t symbol_id, uint64_t nft_id, int64_t delta, name ram_payer)
+{
+    nft_holdings holding_tbl(get_self(), owner.value);
+    auto holding_iter = holding_tbl.find(nft_holding::get_key(symbol_id, nft_id));
+    int64_t balance = 0;
+    if (holding_iter != holding_tbl.end()) {
+        balance = holding_iter->amount;
+    } else {
+        nft_balances nft_balance_tbl(get_self(), symbol_id);
+        auto owner_id_idx = nft_balance_tbl.get_index<"ownerid"_n>();
+        auto legacy_iter = owner_id_idx.find(nft_balance::get_owner_id(owner, nft_id));
+        if (legacy_iter != owner_id_idx.end()) {
+            balance = legacy_iter->quantity.quantity.amount;
+            owner_id_idx.erase(legacy_iter);
+        }
+    }
+
+    check(delta >= 0 || balance >= -delta, "not enough asset");
+    balance += delta;
+    check(balance <= asset::max_amount, "nft balance overflow");
+    if (balance == 0) {
+        if (holding_iter != holding_tbl.end()) {
+            holding_tbl.erase(holding_iter);
+        }
+    } else if (holding_iter == holding_tbl.end()) {
+        holding_tbl.emplace(ram_payer, [&](auto& h) {
+            h.symbol_id = symbol_id;
+            h.nft_id = nft_id;
+            h.amount = balance;
+        });
+    } else {
+        holding_tbl.modify(holding_iter, ram_payer, [&](auto& h) {
+            h.amount = balance;
+        });
+    }
+    return balance;
+}
+
+// sorted by nft id with the duplicates summed
+std::vector<token::nft_batch_args> token::merge_nft_batch(std::vector<nft_batch_args> batch_args)
+{
+    check(batch_args.size(), "invalid batch_args size");
+    extended_symbol ext_sym = batch_args[0].quantity.get_extended_symbol();
+    for (const auto& arg : batch_args) {
+        check(arg.quantity.get_extended_symbol() == ext_sym, "symbol mismatch");
+        check(arg.quantity.quantity.amount > 0, "must transfer positive quantity");
+    }
+    std::sort(batch_args.begin(), batch_args.end(), [](const auto& a, const auto& b) {
+        return a.nft_id < b.nft_id;
+    });
+
+    std::vector<nft_batch_args> merged;
+    merged.reserve(batch_args.size());
+    for (const auto& arg : batch_args) {
+        if (!merged.empty() && merged.back().nft_id == arg.nft_id) {
+            merged.back().quantity += arg.quantity;
+        } else {
+            merged.push_back(arg);
+        }
+    }
+    return merged;
+}
+
+void token::nftcreate(name to, std::string nft_uri, std::string nft_name, std::string extra_data, extended_asset quantity)
+{
+    require_auth(quantity.contract);
+    check(is_account(to), "to account no exists!");
+    check(quantity.quantity.amount > 0, "must issue positive quantity");
+    auto symbol_info = get_nft_symbol(quantity.get_extended_symbol());
 
-    if (symbol_iter->type == ERC721) {
+    if (symbol_info.type == ERC721) {
         check(quantity.quantity.amount == 1, "721 can only issue 1");
     }
 
-    nft_infos nft_info_tbl(_self, symbol_iter->symbol_id);
+    nft_infos nft_info_tbl(_self, symbol_info.symbol_id);
     auto nft_id = nft_info_tbl.available_primary_key();
+    check(nft_id <= max_nft_id, "too many nfts");
     nft_info_tbl.emplace(quantity.contract, [&](auto& n) {
         n.nft_id = nft_id;
         n.nft_uri = nft_uri;
@@ -46,30 +120,22 @@ void token::nftcreate(name to, std::string nft_uri, std::string nft_name, std::s
         n.supply = quantity;
     });
 
-    nft_balances nft_balance_tbl(_self, symbol_iter->symbol_id);
-    nft_balance_tbl.emplace(quantity.contract, [&](auto& n) {
-        n.primary = nft_balance_tbl.available_primary_key();
-        n.owner = to;
-        n.nft_id = nft_id;
-        n.quantity = quantity;
-    });
-    SEND_INLINE_ACTION(*this, nftrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, nft_uri, nft_name, extra_data, quantity });
-    SEND_INLINE_ACTION(*this, nftaccrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, to, quantity });
+    change_nft_holding(to, symbol_info.symbol_id, nft_id, quantity.quantity.amount, quantity.contract);
+    EMIT_EVENT(*this, nftrec, { symbol_info.symbol_id, nft_id, nft_uri, nft_name, extra_data, quantity });
+    EMIT_EVENT(*this, nftaccrec, { symbol_info.symbol_id, nft_id, to, quantity });
 }
 
 void token::nftissue(name to, uint64_t nft_id, extended_asset quantity)
 {
     require_auth(quantity.contract);
     check(is_account(to), "to account no exists!");
-    nft_symbols nft_symbol_tbl(get_self(), get_self().value);
-    auto symbol_idx = nft_symbol_tbl.get_index<"extsymbol"_n>();
-    auto symbol_iter = symbol_idx.find(nft_symbol_info::get_extended_symbol(quantity.get_extended_symbol()));
-    check(symbol_iter != symbol_idx.end(), "symbol not exists");
+    check(quantity.quantity.amount > 0, "must issue positive quantity");
+    auto symbol_info = get_nft_symbol(quantity.get_extended_symbol());
 
-    nft_infos nft_info_tbl(_self, symbol_iter->symbol_id);
+    nft_infos nft_info_tbl(_self, symbol_info.symbol_id);
     auto nft_iter = nft_info_tbl.find(nft_id);
     check(nft_iter != nft_info_tbl.end(), "nft not exists");
-    if (symbol_iter->type == ERC721) {
+    if (symbol_info.type == ERC721) {
         check(nft_iter->supply.quantity.amount == 0, "invalid issue amount");
         check(quantity.quantity.amount == 1, "invalid issue amount");
     }
@@ -77,25 +143,9 @@ void token::nftissue(name to, uint64_t nft_id, extended_asset quantity)
         n.supply += quantity;
     });
 
-    nft_balances nft_balance_tbl(get_self(), symbol_iter->symbol_id);
-    auto owner_id_idx = nft_balance_tbl.get_index<"ownerid"_n>();
-    auto owner_id_iter = owner_id_idx.find(nft_balance::get_owner_id(to, nft_id));
-    auto user_quant = quantity;
-    if (owner_id_iter == owner_id_idx.end()) {
-        nft_balance_tbl.emplace(quantity.contract, [&](auto& n) {
-            n.primary = nft_balance_tbl.available_primary_key();
-            n.owner = to;
-            n.nft_id = nft_id;
-            n.quantity = quantity;
-        });
-    } else {
-        user_quant += owner_id_iter->quantity;
-        owner_id_idx.modify(owner_id_iter, quantity.contract, [&](auto& n) {
-            n.quantity += quantity;
-        });
-    }
-    SEND_INLINE_ACTION(*this, nftrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, nft_iter->nft_uri, nft_iter->nft_name, nft_iter->extra_data, nft_iter->supply });
-    SEND_INLINE_ACTION(*this, nftaccrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, to, user_quant });
+    int64_t balance = change_nft_holding(to, symbol_info.symbol_id, nft_id, quantity.quantity.amount, quantity.contract);
+    EMIT_EVENT(*this, nftrec, { symbol_info.symbol_id, nft_id, nft_iter->nft_uri, nft_iter->nft_name, nft_iter->extra_data, nft_iter->supply });
+    EMIT_EVENT(*this, nftaccrec, { symbol_info.symbol_id, nft_id, to, extended_asset(balance, quantity.get_extended_symbol()) });
 }
 
 void token::nfttransfer(name from, name to, uint64_t nft_id, extended_asset quantity, std::string memo)
@@ -103,38 +153,13 @@ void token::nfttransfer(name from, name to, uint64_t nft_id, extended_asset quan
     require_auth(from);
     check(memo.size() <= 512, "memo has more than 512 bytes");
     check(is_account(to), "to account no exists!");
+    check(quantity.quantity.amount > 0, "must transfer positive quantity");
+    auto symbol_info = get_nft_symbol(quantity.get_extended_symbol());
 
-    nft_symbols nft_symbol_tbl(get_self(), get_self().value);
-    auto symbol_idx = nft_symbol_tbl.get_index<"extsymbol"_n>();
-    auto symbol_iter = symbol_idx.find(nft_symbol_info::get_extended_symbol(quantity.get_extended_symbol()));
-    check(symbol_iter != symbol_idx.end(), "symbol not exists");
-
-    nft_balances nft_balance_tbl(get_self(), symbol_iter->symbol_id);
-    auto owner_id_idx = nft_balance_tbl.get_index<"ownerid"_n>();
-    auto from_iter = owner_id_idx.find(nft_balance::get_owner_id(from, nft_id));
-    check(from_iter != owner_id_idx.end(), "not enough asset");
-    check(from_iter->quantity >= quantity, "not enough asset");
-    owner_id_idx.modify(from_iter, from, [&](auto& n) {
-        n.quantity -= quantity;
-    });
-
-    auto to_iter = owner_id_idx.find(nft_balance::get_owner_id(to, nft_id));
-    auto to_quant = quantity;
-    if (to_iter == owner_id_idx.end()) {
-        nft_balance_tbl.emplace(from, [&](auto& n) {
-            n.primary = nft_balance_tbl.available_primary_key();
-            n.owner = to;
-            n.nft_id = nft_id;
-            n.quantity = quantity;
-        });
-    } else {
-        to_quant += to_iter->quantity;
-        owner_id_idx.modify(to_iter, from, [&](auto& n) {
-            n.quantity += quantity;
-        });
-    }
-    SEND_INLINE_ACTION(*this, nftaccrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, from, from_iter->quantity });
-    SEND_INLINE_ACTION(*this, nftaccrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, to, to_quant });
+    int64_t from_balance = change_nft_holding(from, symbol_info.symbol_id, nft_id, -quantity.quantity.amount, from);
+    int64_t to_balance = change_nft_holding(to, symbol_info.symbol_id, nft_id, quantity.quantity.amount, from);
+    EMIT_EVENT(*this, nftaccrec, { symbol_info.symbol_id, nft_id, from, extended_asset(from_balance, quantity.get_extended_symbol()) });
+    EMIT_EVENT(*this, nftaccrec, { symbol_info.symbol_id, nft_id, to, extended_asset(to_balance, quantity.get_extended_symbol()) });
 }
 
 void token::nfttransferb(name from, name to, std::vector<nft_batch_args> batch_args, std::string memo)
@@ -143,111 +168,63 @@ void token::nfttransferb(name from, name to, std::vector<nft_batch_args> batch_a
     check(memo.size() <= 512, "memo has more than 512 bytes");
     check(is_account(to), "to account no exists!");
 
-    check(batch_args.size(), "invalid batch_args size");
-    extended_symbol ext_sym = batch_args[0].quantity.get_extended_symbol();
-
-    nft_symbols nft_symbol_tbl(get_self(), get_self().value);
-    auto symbol_idx = nft_symbol_tbl.get_index<"extsymbol"_n>();
-    auto symbol_iter = symbol_idx.find(nft_symbol_info::get_extended_symbol(ext_sym));
-    check(symbol_iter != symbol_idx.end(), "symbol not exists");
-
-    nft_balances nft_balance_tbl(get_self(), symbol_iter->symbol_id);
-    auto owner_id_idx = nft_balance_tbl.get_index<"ownerid"_n>();
-
-    for (auto iter = batch_args.begin(); iter != batch_args.end(); iter++) {
-        auto quantity = iter->quantity;
-        auto nft_id = iter->nft_id;
-        check(iter->quantity.get_extended_symbol() == ext_sym, "symbol mismatch");
-        auto from_iter = owner_id_idx.find(nft_balance::get_owner_id(from, nft_id));
-        check(from_iter != owner_id_idx.end(), "not enough asset");
-        check(from_iter->quantity >= quantity, "not enough asset");
-        owner_id_idx.modify(from_iter, from, [&](auto& n) {
-            n.quantity -= quantity;
-        });
-        auto to_iter = owner_id_idx.find(nft_balance::get_owner_id(to, nft_id));
-        auto to_quant = quantity;
-        if (to_iter == owner_id_idx.end()) {
-            nft_balance_tbl.emplace(from, [&](auto& n) {
-                n.primary = nft_balance_tbl.available_primary_key();
-                n.owner = to;
-                n.nft_id = nft_id;
-                n.quantity = quantity;
-            });
-        } else {
-            to_quant += to_iter->quantity;
-            owner_id_idx.modify(to_iter, from, [&](auto& n) {
-                n.quantity += quantity;
-            });
-        }
-        SEND_INLINE_ACTION(*this, nftaccrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, from, from_iter->quantity });
-        SEND_INLINE_ACTION(*this, nftaccrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, to, to_quant });
+    auto merged = merge_nft_batch(std::move(batch_args));
+    extended_symbol ext_sym = merged[0].quantity.get_extended_symbol();
+    auto symbol_info = get_nft_symbol(ext_sym);
+
+    std::vector<nft_balance_change> changes;
+    changes.reserve(merged.size() * 2);
+    for (const auto& arg : merged) {
+        int64_t amount = arg.quantity.quantity.amount;
+        int64_t from_balance = change_nft_holding(from, symbol_info.symbol_id, arg.nft_id, -amount, from);
+        int64_t to_balance = change_nft_holding(to, symbol_info.symbol_id, arg.nft_id, amount, from);
+        changes.push_back({ arg.nft_id, from, -amount, from_balance });
+        changes.push_back({ arg.nft_id, to, amount, to_balance });
     }
+    EMIT_EVENT(*this, nftbatchrec, { symbol_info.symbol_id, ext_sym, changes });
 }
 
 void token::nftburn(name from, uint64_t nft_id, extended_asset quantity)
 {
     require_auth(from);
-    nft_symbols nft_symbol_tbl(get_self(), get_self().value);
-    auto symbol_idx = nft_symbol_tbl.get_index<"extsymbol"_n>();
-    auto symbol_iter = symbol_idx.find(nft_symbol_info::get_extended_symbol(quantity.get_extended_symbol()));
-    check(symbol_iter != symbol_idx.end(), "symbol not exists");
+    check(quantity.quantity.amount > 0, "must burn positive quantity");
+    auto symbol_info = get_nft_symbol(quantity.get_extended_symbol());
 
-    nft_balances nft_balance_tbl(_self, symbol_iter->symbol_id);
-    auto owner_id_idx = nft_balance_tbl.get_index<"ownerid"_n>();
-    auto from_iter = owner_id_idx.find(nft_balance::get_owner_id(from, nft_id));
-    check(from_iter != owner_id_idx.end(), "not enough asset");
-    check(from_iter->quantity >= quantity, "not enough asset");
-    owner_id_idx.modify(from_iter, from, [&](auto& n) {
-        n.quantity -= quantity;
-    });
+    int64_t balance = change_nft_holding(from, symbol_info.symbol_id, nft_id, -quantity.quantity.amount, from);
 
-    nft_infos nft_info_tbl(_self, symbol_iter->symbol_id);
+    nft_infos nft_info_tbl(_self, symbol_info.symbol_id);
     auto nft_iter = nft_info_tbl.find(nft_id);
     check(nft_iter != nft_info_tbl.end(), "nft not exists");
     nft_info_tbl.modify(nft_iter, quantity.contract, [&](auto& n) {
         n.supply -= quantity;
     });
 
-    SEND_INLINE_ACTION(*this, nftrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, nft_iter->nft_uri, nft_iter->nft_name, nft_iter->extra_data, nft_iter->supply });
-    SEND_INLINE_ACTION(*this, nftaccrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, from, from_iter->quantity });
+    EMIT_EVENT(*this, nftrec, { symbol_info.symbol_id, nft_id, nft_iter->nft_uri, nft_iter->nft_name, nft_iter->extra_data, nft_iter->supply });
+    EMIT_EVENT(*this, nftaccrec, { symbol_info.symbol_id, nft_id, from, extended_asset(balance, quantity.get_extended_symbol()) });
 }
 
 void token::burnbatch(name from, std::vector<nft_batch_args> batch_args)
 {
     require_auth(from);
-    check(batch_args.size(), "invalid batch_args size");
-    extended_symbol ext_sym = batch_args[0].quantity.get_extended_symbol();
-
-    nft_symbols nft_symbol_tbl(get_self(), get_self().value);
-    auto symbol_idx = nft_symbol_tbl.get_index<"extsymbol"_n>();
-    auto symbol_iter = symbol_idx.find(nft_symbol_info::get_extended_symbol(ext_sym));
-    check(symbol_iter != symbol_idx.end(), "symbol not exists");
-
-    nft_infos nft_info_tbl(_self, symbol_iter->symbol_id);
-
-    nft_balances nft_balance_tbl(_self, symbol_iter->symbol_id);
-    auto owner_id_idx = nft_balance_tbl.get_index<"ownerid"_n>();
-
-    for (auto iter = batch_args.begin(); iter != batch_args.end(); iter++) {
-        auto quantity = iter->quantity;
-        auto nft_id = iter->nft_id;
-        check(iter->quantity.get_extended_symbol() == ext_sym, "symbol mismatch");
-
-        auto from_iter = owner_id_idx.find(nft_balance::get_owner_id(from, nft_id));
-        check(from_iter != owner_id_idx.end(), "not enough asset");
-        check(from_iter->quantity >= quantity, "not enough asset");
-        owner_id_idx.modify(from_iter, from, [&](auto& n) {
-            n.quantity -= quantity;
-        });
-
-        auto nft_iter = nft_info_tbl.find(nft_id);
+    auto merged = merge_nft_batch(std::move(batch_args));
+    extended_symbol ext_sym = merged[0].quantity.get_extended_symbol();
+    auto symbol_info = get_nft_symbol(ext_sym);
+
+    nft_infos nft_info_tbl(_self, symbol_info.symbol_id);
+    std::vector<nft_balance_change> changes;
+    changes.reserve(merged.size());
+    for (const auto& arg : merged) {
+        int64_t amount = arg.quantity.quantity.amount;
+        int64_t balance = change_nft_holding(from, symbol_info.symbol_id, arg.nft_id, -amount, from);
+        changes.push_back({ arg.nft_id, from, -amount, balance });
+
+        auto nft_iter = nft_info_tbl.find(arg.nft_id);
         check(nft_iter != nft_info_tbl.end(), "nft not exists");
-        nft_info_tbl.modify(nft_iter, quantity.contract, [&](auto& n) {
-            n.supply -= quantity;
+        nft_info_tbl.modify(nft_iter, arg.quantity.contract, [&](auto& n) {
+            n.supply -= arg.quantity;
         });
-
-        SEND_INLINE_ACTION(*this, nftrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, nft_iter->nft_uri, nft_iter->nft_name, nft_iter->extra_data, nft_iter->supply });
-        SEND_INLINE_ACTION(*this, nftaccrec, { _self, "active"_n }, { symbol_iter->symbol_id, nft_id, from, from_iter->quantity });
+        EMIT_EVENT(*this, nftrec, { symbol_info.symbol_id, arg.nft_id, nft_iter->nft_uri, nft_iter->nft_name, nft_iter->extra_data, nft_iter->supply });
     }
+    EMIT_EVENT(*this, nftbatchrec, { symbol_info.symbol_id, ext_sym, changes });
+}
 }
-}
\ No newline at end of file
@@ -38,6 +38,11 @@ void token::redeemrec(name owner, name miner, extended_asset asset)
     require_auth(_self);
 }
 
+void token::lprewardrec(name owner, name miner, extended_asset reward)
+{
+    require_auth(_self);
+}
+
 void token::nftsymrec(uint64_t symbol_id, extended_symbol nft_symbol, std::string symbol_uri, nft_type type)
 {
     require_auth(_self);
@@ -53,6 +58,11 @@ void token::nftaccrec(uint64_t family_id, uint64_t nft_id, name owner, extended_
     require_auth(_self);
 }
 
+void token::nftbatchrec(uint64_t symbol_id, extended_symbol nft_symbol, std::vector<nft_balance_change> changes)
+{
+    require_auth(_self);
+}
+
 void token::liqrec(name miner, extended_asset pst_asset, extended_asset dmc_asset)
 {
     require_auth(_self);
@@ -122,4 +132,53 @@ void token::innerswaprec(extended_asset vrsi, extended_asset dmc)
 {
     require_auth(_self);
 }
+
+void token::catchuprec(uint64_t order_id, uint64_t periods, std::vector<asset_type_args> changed, name owner, AccountType acc_type, time_point_sec exec_date)
+{
+    require_auth(_self);
+}
+
+void token::marketrec(uniswap_market market_info)
+{
+    require_auth(_self);
+}
+
+void token::balancerec(name owner, extended_asset balance)
+{
+    require_auth(_self);
+}
+
+void token::events(uint16_t version, std::vector<event_record> records, binary_extension<uint64_t> first_seq)
+{
+    require_auth(_self);
+}
+
+void token::flush_events()
+{
+    if (_events.empty())
+        return;
+
+    // the sequence is written back by flush_dmc_config, which runs after this
+    uint64_t first_seq = get_dmc_config("eventseq"_n, 0);
+    set_dmc_config("eventseq"_n, first_seq + _events.size());
+
+    DMC_PROFILE_COUNT(inlines);
+    SEND_INLINE_ACTION(*this, events, { _self, "active"_n }, { event_version, _events, first_seq });
+    _events.clear();
+}
+
+#ifdef DMC_TOKEN_PROFILE
+void token::perfrec(std::vector<profile::perf_counters> scopes)
+{
+    require_auth(_self);
+}
+
+void token::flush_profile()
+{
+    if (profile::idle())
+        return;
+
+    SEND_INLINE_ACTION(*this, perfrec, { _self, "active"_n }, { profile::summary() });
+}
+#endif
 }  // namespace eosio
@@ -22,18 +22,16 @@ void token::exdestroy(extended_symbol sym)
 
     if (st.reserve_supply.amount > 0) {
         lock_accounts from_acnts(_self, sym.get_contract().value);
+        auto from_iter = from_acnts.get_index<"byextendedas"_n>();
 
         uint64_t balances = 0;
-        for (auto it = from_acnts.begin(); it != from_acnts.end();) {
-            if (it->balance.get_extended_symbol() == sym) {
-                balances += it->balance.quantity.amount;
-                it = from_acnts.erase(it);
-            } else {
-                it++;
-            }
+        for (auto it = from_iter.lower_bound(lock_account::key(sym, time_point_sec())); it != from_iter.end() && it->balance.get_extended_symbol() == sym;) {
+            balances += it->balance.quantity.amount;
+            it = from_iter.erase(it);
         }
 
         check(st.reserve_supply.amount == balances, "reserve_supply must all in issuer");
+        change_lock_summary(sym.get_contract(), extended_asset(-(int64_t)balances, sym), get_self());
     }
 
     statstable.erase(st);
@@ -44,11 +42,60 @@ void token::exchange(name owner, extended_asset quantity, extended_asset to, dou
     require_auth(owner);
     check(quantity.quantity.is_valid() && to.quantity.is_valid(), "invalid exchange currency");
     check(memo.size() <= 256, "memo has more than 256 bytes");
-    price = 0;
-    auto from_sym = quantity.get_extended_symbol();
-    auto to_sym = to.get_extended_symbol();
+    // limit prices are not supported, price is ignored
+    uniswaporder(owner, quantity, to, id, owner);
+}
+
+void token::exroute(name owner, extended_asset quantity, std::vector<extended_symbol> path, extended_asset min_to, string memo)
+{
+    require_auth(owner);
+    check(quantity.quantity.is_valid() && min_to.quantity.is_valid(), "invalid exchange currency");
+    check(quantity.quantity.amount > 0, "must exchange positive quantity");
+    check(path.size() > 0 && path.size() <= max_route_hops, "invalid route length");
+    check(min_to.get_extended_symbol() == path.back(), "min_to symbol mismatch");
+    check(memo.size() <= 256, "memo has more than 256 bytes");
+
+    sub_balance(owner, quantity);
+
+    swap_market market(get_self(), get_self().value);
+    auto m_index = market.get_index<"bysymbol"_n>();
+    // the intermediate assets never reach the owner's balance
+    extended_asset hop = quantity;
+    for (const auto& to_sym : path) {
+        auto from_sym = hop.get_extended_symbol();
+        auto m_iter = m_index.find(uniswap_market::key(from_sym, to_sym));
+        check(m_iter != m_index.end(), "this uniswap pair dose not exist");
+
+        auto marketx = m_iter->tokenx;
+        auto markety = m_iter->tokeny;
+        extended_asset hop_from = hop;
+        extended_asset spread_from;
+        extended_asset to_fee;
+        if (from_sym == marketx.get_extended_symbol() && to_sym == markety.get_extended_symbol()) {
+            hop = uniswap_swap(marketx, markety, hop, extended_asset(0, to_sym), spread_from, to_fee);
+        } else if (from_sym == markety.get_extended_symbol() && to_sym == marketx.get_extended_symbol()) {
+            hop = uniswap_swap(markety, marketx, hop, extended_asset(0, to_sym), spread_from, to_fee);
+        } else {
+            check(false, "symbol precision mismatch");
+        }
+
+        m_index.modify(m_iter, get_self(), [&](auto& s) {
+            s.tokenx = marketx;
+            s.tokeny = markety;
+        });
+        EMIT_EVENT(*this, marketrec, { *m_iter });
+        // one trade per hop, the fee of each is in the symbol it received
+        EMIT_EVENT(*this, traderecord, { owner, dmc_account, hop_from, hop, to_fee, 0 });
+    }
+    check(hop.quantity.amount >= min_to.quantity.amount, "exchange output below min_to");
+
+    add_balance(owner, hop, owner);
 
-    uniswaporder(owner, quantity, to, price, id, owner);
+    // numbered like every record, the inline action stays as the notification of the owner, dmc.abo retires on it
+    EMIT_EVENT(*this, uniswapsnap, { owner, hop });
+    DMC_PROFILE_COUNT(inlines);
+    SEND_INLINE_ACTION(*this, uniswapsnap, { _self, "active"_n },
+        { owner, hop });
 }
 
 } /// namespace eosio
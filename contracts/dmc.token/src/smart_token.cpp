@@ -54,6 +54,7 @@ void token::exissue(name to, extended_asset quantity, string memo)
     add_balance(foundation, quantity, foundation);
 
     if (to != foundation) {
+        DMC_PROFILE_COUNT(inlines);
         SEND_INLINE_ACTION(*this, extransfer, { foundation, "active"_n }, { foundation, to, quantity, memo });
     }
 
@@ -69,6 +70,7 @@ void token::extransfer(name from, name to, extended_asset quantity, string memo)
     require_auth(from);
 
     if (to == "dmc.ramfee"_n || to == "dmc.saving"_n) {
+        DMC_PROFILE_COUNT(inlines);
         INLINE_ACTION_SENDER(eosio::token, exretire)
         ("dmc.token"_n, { { from, "active"_n } }, { from, quantity, std::string("exretire tokens for producer pay and savings") });
         return;
@@ -113,6 +115,7 @@ void token::exretire(name from, extended_asset quantity, string memo)
     sub_balance(from, quantity);
 
     if (quantity.get_extended_symbol() == pst_sym) {
+        check(!is_liquidating(from), "PST is being liquidated");
         change_pst(from, -quantity);
         dmc_makers maker_tbl(get_self(), get_self().value);
         auto iter = maker_tbl.find(from.value);
@@ -120,6 +123,7 @@ void token::exretire(name from, extended_asset quantity, string memo)
             maker_tbl.modify(iter, get_self(), [&](auto& m) {
                 m.current_rate = cal_current_rate(iter->total_staked, from, iter->get_real_m());
             });
+            EMIT_EVENT(*this, makerecord, {*iter});
         }
     } else {
         sub_stats(quantity);
@@ -128,50 +132,77 @@ void token::exretire(name from, extended_asset quantity, string memo)
 
 void token::exclose(name owner, extended_symbol symbol)
 {
-    accounts acnts(_self, owner.value);
-    auto it_iter = acnts.get_index<"byextendedas"_n>();
-    auto it = it_iter.find(account::key(symbol));
-    check(it != it_iter.end(), "Balance entry does not exist or already deleted. Action will not have any effects.");
+    accounts_v2 acnts(_self, owner.value);
+    auto it = find_account(acnts, owner, symbol);
+    check(it != acnts.end(), "Balance entry does not exist or already deleted. Action will not have any effects.");
     check(it->balance.quantity.amount == 0, "balance entry closed should be zero");
-    it_iter.erase(it);
+    acnts.erase(it);
 }
 
-void token::sub_balance(name owner, extended_asset value)
+// the row of `symbol` in accountsv2, a row still in accounts is moved first
+token::accounts_v2::const_iterator token::find_account(accounts_v2& acnts, name owner, const extended_symbol& symbol)
 {
-    accounts from_acnts(_self, owner.value);
+    DMC_PROFILE_COUNT(db_reads);
+    auto it = acnts.find(account::hashed_key(symbol));
+    if (it != acnts.end()) {
+        check(it->balance.contract == symbol.get_contract() && it->balance.quantity.symbol.code() == symbol.get_symbol().code(), "account key collision");
+        return it;
+    }
+
+    accounts legacy_acnts(_self, owner.value);
+    auto legacy_idx = legacy_acnts.get_index<"byextendedas"_n>();
+    DMC_PROFILE_COUNT(db_reads);
+    auto legacy_it = legacy_idx.find(account::key(symbol));
+    if (legacy_it == legacy_idx.end())
+        return acnts.end();
+
+    extended_asset balance = legacy_it->balance;
+    DMC_PROFILE_COUNT(db_writes);
+    legacy_idx.erase(legacy_it);
+    DMC_PROFILE_COUNT(db_writes);
+    return acnts.emplace(get_self(), [&](auto& a) {
+        a.primary = account::hashed_key(symbol);
+        a.balance = balance;
+    });
+}
 
-    auto from_iter = from_acnts.get_index<"byextendedas"_n>();
-    auto from = from_iter.find(account::key(value.get_extended_symbol()));
+void token::sub_balance(name owner, extended_asset value)
+{
+    accounts_v2 from_acnts(_self, owner.value);
+    auto from = find_account(from_acnts, owner, value.get_extended_symbol());
 
-    check(from != from_iter.end(), "no balance object found.");
+    check(from != from_acnts.end(), "no balance object found.");
     check(from->balance.quantity.amount >= value.quantity.amount, "overdrawn balance when sub balance");
     check(from->balance.quantity.symbol == value.quantity.symbol, "symbol precision mismatch");
 
-    from_iter.modify(from, get_self(), [&](auto& a) {
+    DMC_PROFILE_COUNT(db_writes);
+    from_acnts.modify(from, get_self(), [&](auto& a) {
         a.balance -= value;
     });
+    EMIT_EVENT(*this, balancerec, { owner, from->balance });
 }
 
 void token::add_balance(name owner, extended_asset value, name ram_payer)
 {
-    accounts to_acnts(_self, owner.value);
-    auto to_iter = to_acnts.get_index<"byextendedas"_n>();
-    auto to = to_iter.find(account::key(value.get_extended_symbol()));
+    accounts_v2 to_acnts(_self, owner.value);
+    auto to = find_account(to_acnts, owner, value.get_extended_symbol());
 
-    if (to == to_iter.end()) {
-        to_acnts.emplace(ram_payer, [&](auto& a) {
-            a.primary = to_acnts.available_primary_key();
+    DMC_PROFILE_COUNT(db_writes);
+    if (to == to_acnts.end()) {
+        to = to_acnts.emplace(ram_payer, [&](auto& a) {
+            a.primary = account::hashed_key(value.get_extended_symbol());
             a.balance = value;
         });
     } else if (to->balance.quantity.amount == 0) {
-        to_iter.modify(to, get_self(), [&](auto& a) {
+        to_acnts.modify(to, get_self(), [&](auto& a) {
             a.balance = value;
         });
     } else {
-        to_iter.modify(to, get_self(), [&](auto& a) {
+        to_acnts.modify(to, get_self(), [&](auto& a) {
             a.balance += value;
         });
     }
+    EMIT_EVENT(*this, balancerec, { owner, to->balance });
 }
 
 // the lock parameter is used to delay notification to the system
@@ -206,17 +237,36 @@ void token::change_pst(name owner, extended_asset value, bool lock)
 
 void token::send_totalvote_to_system(name owner) 
 {
-    pststats pst_acnts(get_self(), get_self().value);
-    auto st = pst_acnts.find(owner.value);
-    auto balance = st == pst_acnts.end() ? 0 : st->amount.quantity.amount;
+    _dirty_voters.insert(owner.value);
+}
 
-    lock_accounts from_acnts(_self, owner.value);
-    auto from_iter = from_acnts.get_index<"byextendedas"_n>();
-    auto from = from_iter.find(lock_account::key(pst_sym, time_point_sec(uint32_max)));
-    auto locked_balance_amount = from == from_iter.end() ? 0 : from->balance.quantity.amount;
+void token::flush_totalvotes()
+{
+    if (_dirty_voters.empty())
+        return;
+
+    pststats pst_acnts(get_self(), get_self().value);
+    std::vector<pst_vote> votes;
+    votes.reserve(_dirty_voters.size());
+    for (auto owner_value : _dirty_voters) {
+        name owner(owner_value);
+        DMC_PROFILE_COUNT(db_reads);
+        auto st = pst_acnts.find(owner.value);
+        auto balance = st == pst_acnts.end() ? 0 : st->amount.quantity.amount;
+
+        lock_accounts from_acnts(_self, owner.value);
+        auto from_iter = from_acnts.get_index<"byextendedas"_n>();
+        DMC_PROFILE_COUNT(db_reads);
+        auto from = from_iter.find(lock_account::key(pst_sym, time_point_sec(uint32_max)));
+        auto locked_balance_amount = from == from_iter.end() ? 0 : from->balance.quantity.amount;
+
+        votes.push_back({owner, balance + locked_balance_amount});
+    }
+    _dirty_voters.clear();
 
-    action({_self, "active"_n}, "dmc"_n, "settotalvote"_n,
-           std::make_tuple(owner, balance + locked_balance_amount))
+    DMC_PROFILE_COUNT(inlines);
+    action({_self, "active"_n}, "dmc"_n, "setvotebatch"_n,
+           std::make_tuple(votes))
         .send();
 }
 
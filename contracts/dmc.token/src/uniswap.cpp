@@ -41,31 +41,40 @@ void token::addreserves(name owner, extended_asset x, extended_asset y)
     uint64_t primary;
     if (m_iter == m_index.end()) {
         primary = market.available_primary_key();
-        market.emplace(owner, [&](auto& r) {
+        auto new_iter = market.emplace(owner, [&](auto& r) {
             r.primary = primary;
             r.tokenx = x;
             r.tokeny = y;
             r.total_weights = new_weights;
         });
+        EMIT_EVENT(*this, marketrec, { *new_iter });
     } else {
         primary = m_iter->primary;
 
         extended_asset new_x = m_iter->tokenx + x;
         extended_asset new_y = m_iter->tokeny + y;
-        double real_old_x = get_real_asset(m_iter->tokenx);
-        double real_old_y = get_real_asset(m_iter->tokeny);
-        double real_new_x = get_real_asset(new_x);
-        double real_new_y = get_real_asset(new_y);
-        uint64_t price = real_old_x / real_old_y * std::pow(2, 32);
-        uint64_t new_price = real_new_x / real_new_y * std::pow(2, 32);
-        double div = (double)new_price / (double)price;
-        check(div <= 1.01 && div >= 0.99, "Excessive price volatility");
-
-        SEND_INLINE_ACTION(*this, pricerec, { _self, "active"_n }, { price, new_price });
-        double total = std::sqrt(real_old_x) * std::sqrt(real_old_y);
-        double new_total = std::sqrt(real_new_x) * std::sqrt(real_new_y);
-
-        new_weights = (new_total - total) / total * m_iter->total_weights;
+        uint64_t old_x_amount = m_iter->tokenx.quantity.amount;
+        uint64_t old_y_amount = m_iter->tokeny.quantity.amount;
+        uint64_t new_x_amount = new_x.quantity.amount;
+        uint64_t new_y_amount = new_y.quantity.amount;
+        // |new_x / new_y - old_x / old_y| <= 1% of old_x / old_y
+        fixed::uint128 old_cross = (fixed::uint128)old_x_amount * new_y_amount;
+        fixed::uint128 new_cross = (fixed::uint128)new_x_amount * old_y_amount;
+        fixed::uint128 diff = new_cross > old_cross ? new_cross - old_cross : old_cross - new_cross;
+        check(diff <= old_cross / 100, "Excessive price volatility");
+
+        uint8_t x_precision = sym_x.get_symbol().precision();
+        uint8_t y_precision = sym_y.get_symbol().precision();
+        uint64_t price = fixed::price_x32(old_x_amount, x_precision, old_y_amount, y_precision);
+        uint64_t new_price = fixed::price_x32(new_x_amount, x_precision, new_y_amount, y_precision);
+        EMIT_EVENT(*this, pricerec, { price, new_price });
+
+        // the precisions scale both totals alike and cancel out
+        uint64_t total = fixed::isqrt((fixed::uint128)old_x_amount * old_y_amount);
+        uint64_t new_total = fixed::isqrt((fixed::uint128)new_x_amount * new_y_amount);
+        check(total > 0, "Invalid market reserves");
+
+        new_weights = (double)(new_total - total) / total * m_iter->total_weights;
         check(new_weights > 0, "Invalid new weights");
         check(new_weights / new_weights > 0, "Invalid new weights");
         auto total_weights = m_iter->total_weights + new_weights;
@@ -75,6 +84,7 @@ void token::addreserves(name owner, extended_asset x, extended_asset y)
             s.tokeny = new_y;
             s.total_weights = total_weights;
         });
+        EMIT_EVENT(*this, marketrec, { *m_iter });
     }
 
     swap_pool pool(_self, primary);
@@ -153,13 +163,14 @@ void token::outreserves(name owner, extended_symbol x, extended_symbol y, double
     check(m_iter->tokenx.quantity.amount >= 0, "negative tokenx amount");
     check(m_iter->tokeny.quantity.amount >= 0, "negative tokeny amount");
     check(m_iter->total_weights >= 0, "negative total weights amount");
+    EMIT_EVENT(*this, marketrec, { *m_iter });
     if (m_iter->total_weights == 0)
         m_index.erase(m_iter);
 
     if (rate != 1)
         check(pool_iter->weights / m_iter->total_weights > 0.0001, "The remaining weight is too low");
 
-    SEND_INLINE_ACTION(*this, outreceipt, { _self, "active"_n }, { owner, x_quantity, y_quantity });
+    EMIT_EVENT(*this, outreceipt, { owner, x_quantity, y_quantity });
     if (owner == system_account) {
         sub_stats(x_quantity);
         sub_stats(y_quantity);
@@ -169,7 +180,7 @@ void token::outreserves(name owner, extended_symbol x, extended_symbol y, double
     }
 }
 
-void token::uniswaporder(name owner, extended_asset quantity, extended_asset to, double price, name id, name rampay)
+void token::uniswaporder(name owner, extended_asset quantity, extended_asset to, name id, name rampay)
 {
     auto from_sym = quantity.get_extended_symbol();
     auto to_sym = to.get_extended_symbol();
@@ -185,9 +196,9 @@ void token::uniswaporder(name owner, extended_asset quantity, extended_asset to,
     uint64_t primary = m_iter->primary;
 
     if (from_sym == marketx_sym && to_sym == markety_sym) {
-        uniswapdeal(owner, marketx, markety, quantity, to, primary, price, rampay);
+        uniswapdeal(owner, marketx, markety, quantity, to, primary, rampay);
     } else if (from_sym == markety_sym && to_sym == marketx_sym) {
-        uniswapdeal(owner, markety, marketx, quantity, to, primary, price, rampay);
+        uniswapdeal(owner, markety, marketx, quantity, to, primary, rampay);
     } else {
         check(false, "symbol precision mismatch");
     }
@@ -196,89 +207,73 @@ void token::uniswaporder(name owner, extended_asset quantity, extended_asset to,
         s.tokenx = marketx;
         s.tokeny = markety;
     });
+    EMIT_EVENT(*this, marketrec, { *m_iter });
 }
 
-void token::uniswapdeal(name owner, extended_asset& market_from, extended_asset& market_to, extended_asset from, extended_asset to, uint64_t primary, double price, name rampay)
+void token::uniswapdeal(name owner, extended_asset& market_from, extended_asset& market_to, extended_asset from, extended_asset to, uint64_t primary, name rampay)
+{
+    extended_asset spread_from;
+    extended_asset to_fee;
+    extended_asset spread_to = uniswap_swap(market_from, market_to, from, to, spread_from, to_fee);
+
+    EMIT_EVENT(*this, traderecord, { owner, dmc_account, spread_from, spread_to, to_fee, 0 });
+
+    add_balance(owner, spread_to, rampay);
+    sub_balance(owner, spread_from);
+
+    // numbered like every record, the inline action stays as the notification of the owner, dmc.abo retires on it
+    EMIT_EVENT(*this, uniswapsnap, { owner, spread_to });
+    DMC_PROFILE_COUNT(inlines);
+    SEND_INLINE_ACTION(*this, uniswapsnap, { _self, "active"_n },
+        { owner, spread_to });
+}
+
+/**
+ * constant product swap on raw amounts, the precisions of both sides cancel out of x * y = k:
+ * selling `from` makes the new market_from exactly market_from + from,
+ * buying `to` makes the new market_from the smallest reserve keeping k for market_to - to.
+ * Only the markets are changed, the fee stays in market_to and the owner receives the returned asset.
+ */
+extended_asset token::uniswap_swap(extended_asset& market_from, extended_asset& market_to, extended_asset from, extended_asset to, extended_asset& spread_from, extended_asset& to_fee)
 {
     auto from_sym = from.get_extended_symbol();
     auto to_sym = to.get_extended_symbol();
-    double real_market_from = get_real_asset(market_from);
-    double real_market_to = get_real_asset(market_to);
-    double real_market_total = real_market_from * real_market_to;
-    uint64_t min_price = real_market_from / real_market_to * std::pow(2, 32);
-    uint64_t price_t = price * std::pow(2, 32);
+    uint8_t from_precision = from_sym.get_symbol().precision();
+    uint8_t to_precision = to_sym.get_symbol().precision();
+    uint64_t from_amount = market_from.quantity.amount;
+    uint64_t to_amount = market_to.quantity.amount;
     bool buy = (from.quantity.amount == 0) ? true : false;
-    bool limit = (price_t == 0) ? false : true;
-    bool first = true;
-
-    extended_asset sub_asset = extended_asset(0, from_sym);
-    extended_asset add_asset = extended_asset(0, to_sym);
-    extended_asset from_scrap = extended_asset(0, from_sym);
-    extended_asset to_scrap = extended_asset(0, to_sym);
-    uint64_t new_price_t = uint64_max;
-    double new_price;
+    uint64_t old_price = fixed::price_x32(from_amount, from_precision, to_amount, to_precision);
+
+    uint64_t new_from_amount;
     if (buy) {
-        extended_asset new_to = market_to - to;
-        if (new_to.quantity.amount > 0) {
-            double real_new_to = get_real_asset(new_to);
-            new_price = real_market_total / (real_new_to * real_new_to);
-            new_price_t = new_price * std::pow(2, 32);
-        }
+        check(to.quantity.amount > 0 && to.quantity.amount < market_to.quantity.amount, "exceeding the market reserve");
+        new_from_amount = fixed::mul_div_round(from_amount, to_amount, to_amount - to.quantity.amount);
     } else {
-        extended_asset new_from = market_from + from;
-        double real_new_from = get_real_asset(new_from);
-        new_price = (real_new_from * real_new_from) / real_market_total;
-        new_price_t = new_price * std::pow(2, 32);
+        new_from_amount = (market_from + from).quantity.amount;
     }
+    uint64_t new_to_amount = fixed::mul_div_round(from_amount, to_amount, new_from_amount);
+    uint64_t new_price = fixed::price_x32(new_from_amount, from_precision, new_to_amount, to_precision);
 
-    auto old_price = min_price;
-    price_t = limit ? price_t : new_price_t;
-    min_price = price_t;
-    min_price = std::min(min_price, new_price_t);
-
-    double real_new_from;
-    extended_asset spread_from;
-    double cal_price = std::sqrt(min_price / std::pow(2, 32));
-    if (min_price == new_price_t && min_price != uint64_max)
-        cal_price = std::sqrt(new_price);
-    real_new_from = cal_price * std::sqrt(real_market_total);
-    extended_asset new_market_from = get_asset_by_amount<double, std::round>(real_new_from, from_sym);
+    extended_asset new_market_from = extended_asset(new_from_amount, from_sym);
+    check(new_market_from.quantity.is_valid(), "Invalid asset, please change symbol!");
     spread_from = new_market_from - market_from;
     market_from = new_market_from;
 
-    auto real_new_to = real_market_total / real_new_from;
-    auto new_market_to = get_asset_by_amount<double, std::round>(real_new_to, to_sym);
+    auto new_market_to = extended_asset(new_to_amount, to_sym);
     auto spread_ex_to = market_to - new_market_to;
-    market_to = new_market_to;
-    auto to_fee = extended_asset(std::ceil(spread_ex_to.quantity.amount * uniswap_fee), spread_ex_to.get_extended_symbol());
+    to_fee = extended_asset(fixed::mul_div_ceil(spread_ex_to.quantity.amount, uniswap_fee_per_mille, 1000), to_sym);
     extended_asset spread_to = spread_ex_to - to_fee;
-    to_scrap += to_fee;
     check(spread_from.quantity.amount > 0 && spread_to.quantity.amount > 0, "dust attack detected in uniswap");
+    market_to = new_market_to + to_fee;
 
-    from -= spread_from;
-    to -= spread_ex_to;
-    check(from.quantity.amount >= 0 || to.quantity.amount >= 0, "can't sub/add negative asset"); // never happened
-
-    sub_asset += spread_from;
-    add_asset += spread_to;
-
-    SEND_INLINE_ACTION(*this, pricerec, { _self, "active"_n }, { old_price, min_price });
-    SEND_INLINE_ACTION(*this, traderecord, { _self, "active"_n },
-        { owner, dmc_account, spread_from, spread_to, to_fee, 0 });
-
-    add_balance(owner, add_asset, rampay);
-    sub_balance(owner, sub_asset);
-
-    market_from += from_scrap;
-    market_to += to_scrap;
-
-    SEND_INLINE_ACTION(*this, uniswapsnap, { _self, "active"_n },
-        { owner, add_asset });
+    EMIT_EVENT(*this, pricerec, { old_price, new_price });
+    return spread_to;
 }
 
 double token::get_real_asset(extended_asset quantity)
 {
-    return (double)quantity.quantity.amount / std::pow(10, quantity.get_extended_symbol().get_symbol().precision());
+    return (double)quantity.quantity.amount / fixed::pow10(quantity.get_extended_symbol().get_symbol().precision());
 }
 
 void token::setreserve(name owner, extended_asset dmc_quantity, extended_asset rsi_quantity)
@@ -305,69 +300,174 @@ void token::setreserve(name owner, extended_asset dmc_quantity, extended_asset r
 }
 
 extended_asset token::allocation_abo(time_point_sec now_time) {
-    abostats ast(get_self(), get_self().value);
-    extended_asset to_user(0, dmc_sym);
+    extended_asset to_user = release_abo(now_time, true, 0);
+    if (to_user.quantity.amount > 0) {
+        add_stats(to_user);
+        EMIT_EVENT(*this, allocrec, {to_user, AllocationAbo});
+    }
+    return to_user;
+}
 
-    for (auto it = ast.begin(); it != ast.end();) {
-        if (now_time > it->end_at) {
-            if (it->remaining_release.quantity.amount != 0) {
-                extended_asset curr(it->remaining_release.quantity.amount * it->user_rate, dmc_sym);
-                to_user += curr;
-                ast.modify(it, get_self(), [&](auto& a) {
-                    a.last_user_released_at = it->end_at;
-                    a.remaining_release -= curr;
-                });
-            }
-            it++;
-        } else if (now_time < it->start_at) {
+/**
+ * release one side of the abo stages starting from its cursor: expired stages are released in full and
+ * passed once, the active stage releases its remaining linearly up to end_at, at most once per `min_interval`
+ */
+extended_asset token::release_abo(time_point_sec now_time, bool user, uint64_t min_interval) {
+    abo_cursor_table cursor_tbl(get_self(), get_self().value);
+    auto cursor_iter = cursor_tbl.begin();
+    abo_cursor cursor = cursor_iter != cursor_tbl.end() ? *cursor_iter : abo_cursor{0, 0};
+    uint64_t& cursor_stage = user ? cursor.user_stage : cursor.foundation_stage;
+    uint64_t begin_stage = cursor_stage;
+
+    abostats ast(get_self(), get_self().value);
+    extended_asset released(0, dmc_sym);
+    for (auto it = ast.lower_bound(cursor_stage); it != ast.end(); it++) {
+        if (now_time < it->start_at)
             break;
+
+        abo_stats stats = *it;
+        if (!stats.user_remaining.has_value() || !stats.foundation_remaining.has_value()) {
+            int64_t user_part = stats.remaining_release.quantity.amount * stats.user_rate;
+            stats.user_remaining.emplace(user_part);
+            stats.foundation_remaining.emplace(stats.remaining_release.quantity.amount - user_part);
+        }
+        int64_t& remaining = user ? stats.user_remaining.value() : stats.foundation_remaining.value();
+        time_point_sec& released_at = user ? stats.last_user_released_at : stats.last_foundation_released_at;
+
+        bool expired = now_time > stats.end_at;
+        int64_t amount = 0;
+        if (expired) {
+            amount = remaining;
+            released_at = stats.end_at;
         } else {
-            auto duration_time = now_time.sec_since_epoch() - it->last_user_released_at.sec_since_epoch();
-            auto remaining_time = it->end_at.sec_since_epoch() - it->last_user_released_at.sec_since_epoch();
-            double per = (double)duration_time / (double)remaining_time;
-            extended_asset curr(per * it->remaining_release.quantity.amount * it->user_rate, dmc_sym);
-            to_user += curr;
+            if (released_at >= now_time)
+                break;
+            uint64_t duration_time = now_time.sec_since_epoch() - released_at.sec_since_epoch();
+            if (duration_time < min_interval)
+                break;
+            uint64_t remaining_time = stats.end_at.sec_since_epoch() - released_at.sec_since_epoch();
+            // remaining / remaining_time is the per second rate, it stays the same between calls
+            amount = duration_time >= remaining_time ? remaining : fixed::narrow((fixed::uint128)remaining * duration_time / remaining_time);
+            released_at = now_time;
+        }
+
+        if (amount > 0) {
+            remaining -= amount;
+            stats.remaining_release.quantity.amount = stats.user_remaining.value() + stats.foundation_remaining.value();
+            released.quantity.amount += amount;
             ast.modify(it, get_self(), [&](auto& a) {
-                a.last_user_released_at = now_time;
-                a.remaining_release -= curr;
+                a = stats;
             });
-            break;
         }
+
+        if (!expired)
+            break;
+        cursor_stage = stats.stage + 1;
     }
 
-    if (to_user.quantity.amount > 0) {
-        add_stats(to_user);
-        SEND_INLINE_ACTION(*this, allocrec, {_self, "active"_n}, {to_user, AllocationAbo});
+    if (cursor_stage != begin_stage) {
+        if (cursor_iter == cursor_tbl.end()) {
+            cursor_tbl.emplace(get_self(), [&](auto& c) {
+                c = cursor;
+            });
+        } else {
+            cursor_tbl.modify(cursor_iter, get_self(), [&](auto& c) {
+                c = cursor;
+            });
+        }
     }
-    return to_user;
+    return released;
 }
 
 extended_asset token::allocation_penalty(time_point_sec now_time)
 {
-    penaltystats penst(get_self(), get_self().value);
+    penalty_schedule_table schedule_tbl(get_self(), get_self().value);
+    auto schedule_iter = schedule_tbl.begin();
 
     extended_asset to_penalty(0, dmc_sym);
+    if (schedule_iter == schedule_tbl.end()) {
+        uint64_t now_time_t = now_time.sec_since_epoch();
+        penalty_schedule schedule = {
+            .head_end = time_point_sec(now_time_t + penalty_slot_sec - now_time_t % penalty_slot_sec),
+            .released_at = now_time,
+            .head = 0,
+            .slots = std::vector<int64_t>(penalty_slot_count, 0),
+        };
+        to_penalty.quantity.amount = fold_penalty_stats(schedule, now_time);
+        schedule_iter = schedule_tbl.emplace(get_self(), [&](auto& p) {
+            p = schedule;
+        });
+    } else {
+        penalty_schedule schedule = *schedule_iter;
+        to_penalty.quantity.amount = release_penalty_schedule(schedule, now_time);
+        if (to_penalty.quantity.amount > 0 || schedule.head_end != schedule_iter->head_end) {
+            schedule_tbl.modify(schedule_iter, get_self(), [&](auto& p) {
+                p = schedule;
+            });
+        }
+    }
+
+    if (to_penalty.quantity.amount > 0) {
+        EMIT_EVENT(*this, allocrec, { to_penalty, AllocationPenalty });
+    }
+    return to_penalty;
+}
 
-    for (auto it = penst.begin(); it != penst.end();){
+// releases every slot ended before now_time and the elapsed part of the current one
+int64_t token::release_penalty_schedule(penalty_schedule& schedule, time_point_sec now_time)
+{
+    int64_t released = 0;
+    for (uint64_t i = 0; i < penalty_slot_count && schedule.head_end <= now_time; i++) {
+        released += schedule.slots[schedule.head];
+        schedule.slots[schedule.head] = 0;
+        schedule.released_at = schedule.head_end;
+        schedule.head = (schedule.head + 1) % penalty_slot_count;
+        schedule.head_end += penalty_slot_sec;
+    }
+    if (schedule.head_end <= now_time) {
+        // every slot is empty, move the ring to the current hour
+        uint64_t now_time_t = now_time.sec_since_epoch();
+        schedule.head_end = time_point_sec(now_time_t + penalty_slot_sec - now_time_t % penalty_slot_sec);
+        schedule.released_at = now_time;
+    }
+
+    int64_t& current = schedule.slots[schedule.head];
+    if (current > 0 && now_time > schedule.released_at) {
+        uint64_t duration_time = now_time.sec_since_epoch() - schedule.released_at.sec_since_epoch();
+        uint64_t remaining_time = schedule.head_end.sec_since_epoch() - schedule.released_at.sec_since_epoch();
+        int64_t amount = fixed::mul_div_round(current, duration_time, remaining_time);
+        current -= amount;
+        released += amount;
+    }
+    schedule.released_at = now_time;
+    return released;
+}
+
+// moves the rows of the former penaltystats table into a new schedule, its slots start at the current hour
+int64_t token::fold_penalty_stats(penalty_schedule& schedule, time_point_sec now_time)
+{
+    penaltystats penst(get_self(), get_self().value);
+
+    int64_t released = 0;
+    for (auto it = penst.begin(); it != penst.end();) {
+        int64_t remaining = it->remaining_release.quantity.amount;
         if (now_time >= it->end_at) {
-            to_penalty += it->remaining_release;
-            it = penst.erase(it);
+            released += remaining;
         } else {
-            auto duration_time = now_time.sec_since_epoch() - it->start_at.sec_since_epoch();
-            auto remaining_time = it->end_at.sec_since_epoch() - it->start_at.sec_since_epoch();
-            double per = (double)duration_time / (double)remaining_time;
-            uint64_t total_asset_amount = per * it->remaining_release.quantity.amount;
-            to_penalty.quantity.amount += total_asset_amount;
-
-            penst.modify(it, get_self(), [&](auto& p) {
-                p.start_at = now_time;
-                p.remaining_release.quantity.amount -= total_asset_amount;
-            });
-            break;
+            if (now_time > it->start_at) {
+                uint64_t duration_time = now_time.sec_since_epoch() - it->start_at.sec_since_epoch();
+                uint64_t remaining_time = it->end_at.sec_since_epoch() - it->start_at.sec_since_epoch();
+                int64_t amount = fixed::mul_div_round(remaining, duration_time, remaining_time);
+                released += amount;
+                remaining -= amount;
+            }
+            uint64_t offset = (it->end_at.sec_since_epoch() - schedule.head_end.sec_since_epoch() + penalty_slot_sec - 1) / penalty_slot_sec;
+            offset = std::min(offset, penalty_slot_count - 1);
+            schedule.slots[(schedule.head + offset) % penalty_slot_count] += remaining;
         }
+        it = penst.erase(it);
     }
-    SEND_INLINE_ACTION(*this, allocrec, { _self, "active"_n }, { to_penalty, AllocationPenalty });
-    return to_penalty;
+    return released;
 }
 
 void token::increase_penalty(extended_asset quantity) 
@@ -375,59 +475,29 @@ void token::increase_penalty(extended_asset quantity)
     check(quantity.get_extended_symbol() == dmc_sym, "only DMC can be penalty");
     time_point_sec now_time = time_point_sec(current_time_point());
     uint64_t now_time_t = now_time.sec_since_epoch();
-    uint64_t nearest_hour_time = now_time.sec_since_epoch() + 3600 - now_time.sec_since_epoch() % 3600;
+    uint64_t nearest_hour_time = now_time.sec_since_epoch() + penalty_slot_sec - now_time.sec_since_epoch() % penalty_slot_sec;
     uint64_t sec_to_nearest_hour = nearest_hour_time - now_time_t;
-    uint64_t copies = 11;
+    uint64_t copies = penalty_slot_count - 1;
 
-    auto final_end_time = time_point_sec(nearest_hour_time) + eosio::hours(copies);
-    uint64_t sec_to_final_end_time = final_end_time.sec_since_epoch() - now_time_t;
-    double per = (double)sec_to_nearest_hour / (double)sec_to_final_end_time;
-
-    extended_asset first_period = extended_asset(quantity.quantity.amount * per, dmc_sym);
-    extended_asset other_period_total = quantity - first_period;
-    extended_asset other_period = extended_asset(other_period_total.quantity.amount / copies, dmc_sym);
+    uint64_t sec_to_final_end_time = sec_to_nearest_hour + copies * penalty_slot_sec;
+    int64_t first_period = fixed::mul_div_round(quantity.quantity.amount, sec_to_nearest_hour, sec_to_final_end_time);
+    int64_t other_period = (quantity.quantity.amount - first_period) / copies;
     // for rounding error
-    extended_asset real_other_period_total = extended_asset(other_period.quantity.amount * copies, dmc_sym);
-    extended_asset real_first_period = first_period + (other_period_total - real_other_period_total);
+    int64_t real_first_period = quantity.quantity.amount - other_period * copies;
 
     extended_asset dmc_quantity = allocation_penalty(now_time);
     exchange_from_uniswap(dmc_quantity);
 
-    penaltystats penst(get_self(), get_self().value);
-
-    // the first period
-    {
-        auto it = penst.begin();
-        if (it != penst.end()) {
-            penst.modify(it, get_self(), [&](auto& p) {
-                p.remaining_release += real_first_period;
-            });
-        } else {
-            penst.emplace(get_self(), [&](auto& p) {
-                p.start_at = now_time;
-                p.end_at = time_point_sec(nearest_hour_time);
-                p.remaining_release = real_first_period;
-            });
-        }
-    }
-
-    // the other periods
-    for (int i = 0; i < copies; i++) {
-        auto end_time = time_point_sec(nearest_hour_time) + eosio::hours(i + 1);
-        auto start_time = time_point_sec(nearest_hour_time) + eosio::hours(i);
-        auto it = penst.find(end_time.sec_since_epoch());
-        if (it != penst.end()) {
-            penst.modify(it, get_self(), [&](auto& p) {
-                p.remaining_release += other_period;
-            });
-        } else {
-            penst.emplace(get_self(), [&](auto& p) {
-                p.start_at = start_time;
-                p.end_at = end_time;
-                p.remaining_release = other_period;
-            });
+    // allocation_penalty left the ring at the current hour
+    penalty_schedule_table schedule_tbl(get_self(), get_self().value);
+    auto schedule_iter = schedule_tbl.begin();
+    schedule_tbl.modify(schedule_iter, get_self(), [&](auto& p) {
+        p.released_at = now_time;
+        p.slots[p.head] += real_first_period;
+        for (uint64_t i = 1; i <= copies; i++) {
+            p.slots[(p.head + i) % penalty_slot_count] += other_period;
         }
-    }
+    });
 }
 
 extended_asset token::exchange_from_uniswap(extended_asset add_balance) 
@@ -440,6 +510,7 @@ extended_asset token::exchange_from_uniswap(extended_asset add_balance)
 
     inner_market market(get_self(), get_self().value);
     auto m_index = market.get_index<"bysymbol"_n>();
+    DMC_PROFILE_COUNT(db_reads);
     auto m_iter = m_index.find(inner_uniswap_market::key(rsi_sym, dmc_sym));
     check(m_iter != m_index.end(), "this uniswap pair dose not exist");
 
@@ -448,37 +519,33 @@ extended_asset token::exchange_from_uniswap(extended_asset add_balance)
     auto rsi_quantity = m_iter->tokenx;
     auto dmc_quantity = m_iter->tokeny;
 
-    // S = rsi x dmc
-    double real_rsi_quantity = get_real_asset(rsi_quantity);
-    double real_dmc_quantity = get_real_asset(dmc_quantity);
-    double real_market_total = real_rsi_quantity * real_dmc_quantity;
+    // S = rsi x dmc, kept on raw amounts
+    uint64_t rsi_amount = rsi_quantity.quantity.amount;
+    uint64_t dmc_amount = dmc_quantity.quantity.amount;
 
     extended_asset to_user(0, dmc_sym);
     if (add_balance.get_extended_symbol() == rsi_sym) {
         rsi_quantity += add_balance;
-        real_rsi_quantity = get_real_asset(rsi_quantity);
-        double real_dmc_quantity = real_market_total / real_rsi_quantity;
-        extended_asset new_dmc_quantity = get_asset_by_amount<double, std::round>(real_dmc_quantity, dmc_sym);
-        
+        extended_asset new_dmc_quantity = extended_asset(fixed::mul_div_round(rsi_amount, dmc_amount, rsi_quantity.quantity.amount), dmc_sym);
+
         // DMC need return to user
         to_user = dmc_quantity - new_dmc_quantity;
         dmc_quantity = new_dmc_quantity;
     } else if (add_balance.get_extended_symbol() == dmc_sym) {
         dmc_quantity += add_balance;
-        real_dmc_quantity = get_real_asset(dmc_quantity);
-        double real_rsi_quantity = real_market_total / real_dmc_quantity;
-        extended_asset new_rsi_quantity = get_asset_by_amount<double, std::round>(real_rsi_quantity, rsi_sym);
+        extended_asset new_rsi_quantity = extended_asset(fixed::mul_div_round(rsi_amount, dmc_amount, dmc_quantity.quantity.amount), rsi_sym);
 
         rsi_quantity = new_rsi_quantity;
     } else {
         check(false, "only RSI and DMC can be added to uniswap market");
     }
 
+    DMC_PROFILE_COUNT(db_writes);
     m_index.modify(m_iter, get_self(), [&](auto& m) {
         m.tokenx = rsi_quantity;
         m.tokeny = dmc_quantity;
     });
-    SEND_INLINE_ACTION(*this, innerswaprec, { {get_self(), "active"_n} }, { add_balance, to_user });
+    EMIT_EVENT(*this, innerswaprec, { add_balance, to_user });
     return to_user;
 }
 
@@ -489,6 +556,7 @@ extended_asset token::exchange_from_uniswap(extended_asset add_balance)
  */
 extended_asset token::get_dmc_by_vrsi(extended_asset add_rsi_quantity)
 {
+    DMC_PROFILE_SCOPE(ScopeDmcByVrsi);
     time_point_sec now_time = time_point_sec(current_time_point());
     // 1. exchange DMC to RSI 
     extended_asset dmc_add = allocation_abo(now_time) + allocation_penalty(now_time);